@@ -0,0 +1,23 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Counts every call to the global operator new in the process. This header *defines* the
+// replacement operators, so include it from exactly one translation unit of a program and
+// diff heapAllocations() around the code that is supposed to stay off the heap.
+
+inline std::atomic<std::size_t> g_heapAllocations{0};
+
+inline std::size_t heapAllocations() { return g_heapAllocations.load(std::memory_order_relaxed); }
+
+void* operator new(std::size_t n) {
+    g_heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include "sequencer.h"
+
+// Order entry over persistent TCP connections speaking the fixed-layout messages in
+// binary_protocol.h. Runs on the same io_context (and sequencer producers) as the HTTP API.
+void startBinaryGateway(boost::asio::io_context& ioc, boost::asio::ip::tcp::endpoint ep, Sequencer& engine);
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Fixed-layout order-entry protocol for the binary gateway. Every message starts with
+// MsgHeader, is a multiple of 8 bytes and has all fields naturally aligned, so a stream of
+// them read into an 8-aligned buffer can be used in place. Integers are little-endian
+// (host order on everything we run on). Prices are fixed point: price * priceScale.
+//
+// Client -> server: NewOrder, Cancel.   Server -> client: Ack, Fill, Reject.
+// Each side numbers its own messages 1, 2, 3...; replies echo the request's seq.
+namespace wire {
+
+constexpr std::int64_t priceScale = 10000;
+constexpr std::uint8_t version = 1;
+
+enum MsgType : std::uint8_t {
+    NewOrder = 'N',
+    Cancel = 'C',
+    Ack = 'A',
+    Fill = 'F',
+    Reject = 'R',
+};
+
+enum RejectReason : std::uint8_t {
+    BadMessage = 1,      // malformed fields (side, type, qty, price)
+    BadSymbol = 2,
+    UnknownOrder = 3,    // cancel of an id that isn't resting
+    PriceOutOfRange = 4, // too far from the book for the ladder
+    SequenceGap = 5,     // seq wasn't last accepted + 1; the message was dropped
+};
+
+enum AckKind : std::uint8_t { Accepted = 1, Cancelled = 2 };
+
+struct MsgHeader {
+    std::uint16_t length;   // whole message, header included
+    std::uint8_t type;      // MsgType
+    std::uint8_t version;
+    std::uint32_t seq;
+};
+
+struct NewOrderMsg {
+    MsgHeader header;
+    char symbol[16];        // zero padded
+    std::int64_t price;     // ignored for market orders
+    std::int32_t qty;
+    std::uint8_t side;      // 0 buy, 1 sell
+    std::uint8_t orderType; // 0 limit, 1 market
+    std::uint8_t pad[2];
+};
+
+struct CancelMsg {
+    MsgHeader header;
+    char symbol[16];
+    std::uint64_t orderId;
+};
+
+struct AckMsg {
+    MsgHeader header;
+    std::uint32_t requestSeq;
+    std::uint8_t kind;      // AckKind
+    std::uint8_t pad[3];
+    std::uint64_t orderId;  // 0 for market orders
+};
+
+// Aggregate execution of one incoming order against the book.
+struct FillMsg {
+    MsgHeader header;
+    std::uint32_t requestSeq;
+    std::int32_t filled;
+    std::int64_t avgPrice;
+    std::uint64_t orderId;
+    std::uint32_t trades;
+    std::uint32_t pad;
+};
+
+struct RejectMsg {
+    MsgHeader header;
+    std::uint32_t requestSeq;
+    std::uint8_t reason;    // RejectReason
+    std::uint8_t pad[3];
+};
+
+static_assert(sizeof(MsgHeader) == 8);
+static_assert(sizeof(NewOrderMsg) == 40);
+static_assert(sizeof(CancelMsg) == 32);
+static_assert(sizeof(AckMsg) == 24);
+static_assert(sizeof(FillMsg) == 40);
+static_assert(sizeof(RejectMsg) == 16);
+static_assert(std::is_trivially_copyable_v<NewOrderMsg> && std::is_trivially_copyable_v<FillMsg>);
+
+constexpr std::size_t maxMessage = 64;
+
+} // namespace wire
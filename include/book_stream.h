@@ -0,0 +1,44 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <boost/beast/http.hpp>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "sequencer.h"
+
+class StreamSession;
+
+// Live book over WebSocket (GET /stream?symbol=...). A subscriber gets a full snapshot
+// tagged with the book's update seq, then every BookUpdate after it. Updates arrive from
+// the shards already coalesced per matching pass; the hub turns each one into JSON once,
+// on its own strand, and hands the same shared string to every subscriber of the symbol.
+class StreamHub : public MarketFeed {
+public:
+    StreamHub(boost::asio::io_context& ioc, Sequencer& engine);
+
+    void publish(std::shared_ptr<const BookUpdate> update) override;
+    bool wants(const Symbol& symbol) const override;
+
+    // Take over an HTTP connection whose request asked to upgrade.
+    void accept(boost::asio::ip::tcp::socket socket,
+                boost::beast::http::request<boost::beast::http::string_body> req,
+                const Symbol& symbol);
+
+private:
+    friend class StreamSession;
+    void subscribe(const Symbol& symbol, const std::shared_ptr<StreamSession>& session);
+    std::atomic<std::uint32_t>& watched(const Symbol& symbol) { return watched_[SymbolHash{}(symbol) % watched_.size()]; }
+
+    boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+    Sequencer& engine_;
+    std::unordered_map<Symbol, std::vector<std::weak_ptr<StreamSession>>, SymbolHash> subscribers_; // strand only
+    // Symbols in subscribers_ per hash slot, so the shards can skip unwatched books without the
+    // strand. A collision only costs an update nobody reads.
+    std::array<std::atomic<std::uint32_t>, 1024> watched_{};
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <time.h>
+
+#include "orderbook.h"
+
+// One OHLCV bar. Only intervals that traded get a bar, so neighbours can be more than one
+// interval apart.
+struct Candle {
+    std::int64_t start;     // unix seconds, a multiple of the interval
+    double open;
+    double high;
+    double low;
+    double close;
+    std::int64_t volume;
+    double notional;        // sum of price * qty; vwap = notional / volume
+    std::uint64_t trades;
+};
+
+// Wall clock seconds for bar starts. The coarse clock is a few ms behind at worst and several
+// times cheaper to read than system_clock, which is plenty for one-second bars.
+inline std::int64_t candleClock() {
+#ifdef CLOCK_REALTIME_COARSE
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return static_cast<std::int64_t>(ts.tv_sec);
+#else
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// The last `capacity` bars of one interval in a ring. The ring is allocated on the first
+// trade; after that adding is a compare and a handful of stores.
+class CandleSeries {
+public:
+    static constexpr std::size_t capacity = 512;
+
+    explicit CandleSeries(std::int64_t interval) : interval_(interval) {}
+
+    // Folds in a bar's worth of trades that all happened at part.start.
+    void add(const Candle& part) {
+        std::int64_t start = part.start - part.start % interval_;
+        if (count_ == 0 || start > bars_[head_].start) {
+            if (!bars_) bars_ = std::make_unique<Candle[]>(capacity);
+            head_ = count_ == 0 ? 0 : (head_ + 1) % capacity;
+            if (count_ < capacity) ++count_;
+            bars_[head_] = part;
+            bars_[head_].start = start;
+            return;
+        }
+        // Same bar (or the clock stepped back, which folds into it too).
+        Candle& bar = bars_[head_];
+        if (part.high > bar.high) bar.high = part.high;
+        if (part.low < bar.low) bar.low = part.low;
+        bar.close = part.close;
+        bar.volume += part.volume;
+        bar.notional += part.notional;
+        bar.trades += part.trades;
+    }
+
+    // The newest n bars (fewer if there aren't that many), oldest first. Reuses out's capacity.
+    void latest(std::size_t n, std::vector<Candle>& out) const {
+        n = n < count_ ? n : count_;
+        out.resize(n);
+        std::size_t at = (head_ + capacity + 1 - n) % capacity;
+        for (std::size_t i = 0; i < n; ++i, at = (at + 1) % capacity) out[i] = bars_[at];
+    }
+    std::int64_t interval() const { return interval_; }
+    std::size_t size() const { return count_; }
+
+private:
+    std::int64_t interval_;
+    std::unique_ptr<Candle[]> bars_;
+    std::size_t head_{0};   // newest bar
+    std::size_t count_{0};
+};
+
+// Bars for every interval /candles serves. Each batch of trades is summed once and the sum
+// goes into every interval.
+class CandleSet {
+public:
+    static constexpr std::array<std::int64_t, 5> intervals{1, 10, 60, 300, 3600};
+
+    CandleSet() : series_{CandleSeries(1), CandleSeries(10), CandleSeries(60), CandleSeries(300), CandleSeries(3600)} {}
+
+    // Trades that all happened at `now` (unix seconds), in order.
+    void add(const TradePrint* trades, std::size_t count, std::int64_t now) {
+        if (count == 0) return;
+        double first = trades[0].price;
+        Candle part{now, first, first, first, trades[count - 1].price, 0, 0.0, count};
+        for (std::size_t i = 0; i < count; ++i) {
+            double price = trades[i].price;
+            if (price > part.high) part.high = price;
+            if (price < part.low) part.low = price;
+            part.volume += trades[i].qty;
+            part.notional += price * static_cast<double>(trades[i].qty);
+        }
+        for (CandleSeries& series : series_) series.add(part);
+    }
+    // nullptr if interval isn't one of `intervals`.
+    const CandleSeries* find(std::int64_t interval) const {
+        for (const CandleSeries& series : series_) {
+            if (series.interval() == interval) return &series;
+        }
+        return nullptr;
+    }
+
+private:
+    std::array<CandleSeries, intervals.size()> series_;
+};
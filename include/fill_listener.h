@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "orderbook.h"
+#include "spsc_ring.h"
+
+using FillQueue = SpscRing<Fill, 1u << 16>;
+
+// Copies every fill into a preallocated SPSC ring for another thread (or the same one,
+// between calls) to drain, e.g. a trade feed. The matching thread never waits on the
+// reader: a fill that finds the ring full is counted in dropped() and lost.
+class RingFillListener {
+public:
+    // No default: a listener without a queue would crash on the first fill.
+    explicit RingFillListener(FillQueue* queue) : queue_(queue) {}
+
+    void onFill(const Fill& fill) {
+        if (!queue_->tryPush(fill)) ++dropped_;
+    }
+    std::uint64_t dropped() const { return dropped_; }
+
+private:
+    FillQueue* queue_;
+    std::uint64_t dropped_{0};
+};
+
+extern template class basic_orderbook<double, int, RingFillListener>;
+using RingFillBook = basic_orderbook<double, int, RingFillListener>;
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "symbol.h"
+
+// Serialised GET /book bodies, shared by every connection, one per symbol and depth. An
+// entry stays good until its book's version moves, so a poll of a quiet book is a lookup
+// and a copy instead of a snapshot on the matching thread plus a fresh serialise.
+class BookCache {
+public:
+    static constexpr std::size_t maxEntries = 4096;    // past this the cache starts over
+    static constexpr std::size_t etagSize = 40;
+
+    BookCache();
+
+    // Quoted ETag for a book at `version`, written into buf (etagSize bytes). Tags include a
+    // per-process part, so a tag from before a restart never matches.
+    std::string_view etag(std::uint64_t version, char* buf) const;
+    // Copies the body into out if there's an entry at exactly this version.
+    bool find(const Symbol& symbol, std::size_t depth, std::uint64_t version, std::string& out) const;
+    // Keeps the newer of this and whatever is already there.
+    void store(const Symbol& symbol, std::size_t depth, std::uint64_t version, std::string_view body);
+
+private:
+    struct Key {
+        Symbol symbol;
+        std::size_t depth;
+        bool operator==(const Key& other) const { return symbol == other.symbol && depth == other.depth; }
+    };
+    struct KeyHash {
+        std::size_t operator()(const Key& key) const { return SymbolHash{}(key.symbol) ^ (key.depth * 0x9e3779b97f4a7c15ull); }
+    };
+    struct Entry {
+        std::uint64_t version{0};
+        std::string body;
+    };
+
+    std::uint64_t boot_;
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<Key, Entry, KeyHash> entries_;
+};
+
+// The web UI's files, read once at startup with a gzip copy of each, so serving one is a
+// map lookup and a memcpy rather than a trip to the disk.
+class StaticAssets {
+public:
+    struct Asset {
+        std::string contentType;
+        std::string body;
+        std::string gzipped;    // empty when compressing didn't make it smaller
+        std::string etag;       // quoted hash of body
+        std::string gzipEtag;   // the same with -gz on the end
+    };
+
+    // Every regular file directly in dir, served as "/<name>"; index.html is "/" as well.
+    // A missing dir just leaves nothing loaded.
+    void load(const std::string& dir);
+    const Asset* find(std::string_view path) const;
+    std::size_t files() const { return files_; }
+
+private:
+    std::map<std::string, Asset, std::less<>> assets_;
+    std::size_t files_{0};
+};
+
+// Whether an If-None-Match value names etag (or is "*"). Weak tags count, as they do for GET.
+bool etagMatches(std::string_view ifNoneMatch, std::string_view etag);
+// Whether an Accept-Encoding value allows gzip.
+bool acceptsGzip(std::string_view acceptEncoding);
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "spsc_ring.h"
+#include "symbol.h"
+
+// One state-changing command as it was run by a shard. Replaying the records of a symbol in
+// order through a fresh book rebuilds it exactly, ids included.
+struct JournalRecord {
+    std::uint8_t kind;      // EngineCommand::Kind
+    std::uint8_t side;      // Side
+    std::uint8_t hasPrice;
+    std::uint8_t pad;
+    std::int32_t qty;
+    double price;
+    std::uint64_t id;
+    Symbol symbol;
+    std::uint64_t check;    // hash of everything above; replay stops at the first record that fails it
+
+    void seal() { check = hash(); }
+    bool intact() const { return check == hash(); }
+    std::uint64_t hash() const;
+};
+
+static_assert(sizeof(JournalRecord) == 48);
+
+enum class FsyncPolicy { Never, EveryBatch, Interval };
+
+struct JournalConfig {
+    std::string path;
+    FsyncPolicy fsync{FsyncPolicy::EveryBatch};
+    std::chrono::milliseconds fsyncInterval{100}; // FsyncPolicy::Interval
+    std::size_t batchBytes{1u << 20};             // most bytes handed to one write()
+};
+
+struct ReplayStats {
+    std::size_t records{0};
+    std::size_t validBytes{0};  // header + intact records; anything after is a torn tail
+    double seconds{0.0};
+};
+
+// Append-only command log. Each shard pushes records into its own SPSC ring and a background
+// thread drains them into batched write()s, fsyncing per the policy, so the matching path
+// only ever copies 48 bytes. Records are written after the command ran, so a crash can lose
+// the last un-synced batch but never leaves a half-applied command in the file.
+class Journal {
+public:
+    static constexpr std::size_t ringCapacity = 1u << 16;
+
+    // Opens (or creates) the file, cutting it back to `validBytes` first if replay found a
+    // torn tail. Throws std::runtime_error if the file can't be opened.
+    Journal(const JournalConfig& config, std::size_t producers, std::size_t validBytes);
+    ~Journal();
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    void start();
+    // Drains everything already appended, syncs unless the policy is Never, and joins.
+    void stop();
+
+    // Same single-thread-per-producer rule as Sequencer::submit. Spins while the ring is full.
+    void append(std::size_t producer, const JournalRecord& record);
+
+    // Maps the file and calls fn for every intact record in order, starting at byte `from`
+    // (a record boundary, e.g. what a snapshot covered). A missing file is an empty journal.
+    static ReplayStats replay(const std::string& path, const std::function<void(const JournalRecord&)>& fn,
+                              std::size_t from = 0);
+    static constexpr std::size_t headerBytes = 16;
+
+private:
+    void loop();
+    void sync();
+
+    JournalConfig config_;
+    int fd_{-1};
+    std::vector<std::unique_ptr<SpscRing<JournalRecord, ringCapacity>>> rings_;
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+};
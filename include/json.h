@@ -0,0 +1,83 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "candles.h"
+#include "orderbook.h"
+
+// The little bit of JSON the server speaks. Writer appends straight into a caller-owned
+// string with std::to_chars (shortest round-trip form for doubles, no locale, no stream), so
+// a connection that reuses its response buffers serialises without allocating once they've
+// grown to size.
+namespace json {
+
+class Writer {
+public:
+    explicit Writer(std::string& out) : out_(out) {}
+
+    Writer& operator<<(std::string_view text) {
+        out_.append(text);
+        return *this;
+    }
+    Writer& operator<<(char c) {
+        out_.push_back(c);
+        return *this;
+    }
+    Writer& operator<<(double value);
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+    Writer& operator<<(T value) {
+        char buf[32];
+        out_.append(buf, std::to_chars(buf, buf + sizeof(buf), value).ptr);
+        return *this;
+    }
+
+private:
+    std::string& out_;
+};
+
+// {"price":...,"qty":...,"orders":...} per level, comma separated.
+void levels(Writer& out, const std::vector<BookLevel>& levels);
+// GET /book reply.
+void book(std::string& out, const BookSnapshot& snap, std::optional<double> spread, std::uint64_t seq);
+// Reply for a limit, market or modify that went through. Market orders have no id.
+void execution(std::string& out, const ExecutionResults& exec, bool withId, long long latencyNs);
+// Reply for a batch: totals, then one entry per order in order (the execution fields, or an
+// error for a limit rejected as too far from the book).
+void batch(std::string& out, const std::vector<ExecutionResults>& results, long long latencyNs);
+// GET /candles reply: {"interval":60,"candles":[{"start":...,"open":...,"high":...,"low":...,
+// "close":...,"volume":...,"vwap":...,"trades":...},...]}, oldest first.
+void candles(std::string& out, std::int64_t interval, const std::vector<Candle>& bars);
+
+// Fields of a POST /orders or PATCH /orders/{id} body; absent ones stay empty.
+struct OrderFields {
+    std::string_view symbol;      // points into the body
+    std::optional<Side> side;
+    std::optional<OrderType> type;
+    std::optional<double> price;
+    std::optional<int> qty;
+    std::optional<double> stopPrice;
+};
+
+// One pass over an order body: a flat object whose keys are among symbol, side, type, price,
+// qty and stop_price, each at most once. Strings can't contain escapes (no valid value needs
+// one), prices must be positive, finite and at most 1e12, and quantities whole numbers from 1 to INT_MAX.
+// Types are limit, market, stop and stop_limit. Returns nullptr, or why the body was refused.
+const char* parseOrder(std::string_view body, OrderFields& out);
+// Why a parsed new order can't be placed (a field missing, or stop_price on a non-stop), or nullptr.
+const char* incomplete(const OrderFields& order);
+
+// A POST /orders/batch body: {"symbol":"AAPL","orders":[{...},...]}, symbol optional. Each
+// order is an order body as above without a symbol, and must be complete (side, type, qty and
+// the prices its type needs). Replaces out with up to maxOrders of them. Returns nullptr, or why the
+// body was refused with `at` set to the index of the order at fault (noOrder if it's not one).
+inline constexpr std::size_t noOrder = static_cast<std::size_t>(-1);
+const char* parseBatch(std::string_view body, std::string_view& symbol, std::vector<OrderCommand>& out, std::size_t maxOrders,
+                       std::size_t& at);
+
+} // namespace json
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Log-linear histogram of nanosecond samples: exact below 128, then 64 buckets per power
+// of two (under 1.6% error) all the way to 2^63. Fixed size, so recording never allocates,
+// and two histograms merge by adding counts.
+class LatencyHistogram {
+public:
+    void record(std::uint64_t ns) {
+        ++counts_[bucket(ns)];
+        ++total_;
+        max_ = std::max(max_, ns);
+        min_ = std::min(min_, ns);
+    }
+
+    // Coordinated-omission fix for a closed-loop client that expects to send every
+    // `interval` ns (HdrHistogram's recordValueWithExpectedInterval): a sample that took
+    // longer also stands for the requests that stall held back, each waiting interval less.
+    void record(std::uint64_t ns, std::uint64_t interval) {
+        record(ns);
+        if (interval == 0) return;
+        while (ns > interval) {
+            ns -= interval;
+            record(ns);
+        }
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (std::size_t i = 0; i < buckets; ++i) counts_[i] += other.counts_[i];
+        total_ += other.total_;
+        max_ = std::max(max_, other.max_);
+        min_ = std::min(min_, other.min_);
+    }
+
+    void reset() { *this = LatencyHistogram{}; }
+
+    std::uint64_t count() const { return total_; }
+    std::uint64_t max() const { return max_; }
+    std::uint64_t min() const { return total_ ? min_ : 0; }
+
+    // Upper edge of the bucket holding the q-th quantile (q in [0, 1]), capped at max().
+    std::uint64_t percentile(double q) const {
+        if (total_ == 0) return 0;
+        std::uint64_t rank = static_cast<std::uint64_t>(q * static_cast<double>(total_) + 0.5);
+        rank = std::clamp<std::uint64_t>(rank, 1, total_);
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < buckets; ++i) {
+            seen += counts_[i];
+            if (seen >= rank) return std::min(upperEdge(i), max_);
+        }
+        return max_;
+    }
+
+private:
+    static constexpr std::size_t linear = 128;
+    static constexpr std::size_t perOctave = 64;
+    static constexpr std::size_t buckets = linear + 57 * perOctave;
+
+    static std::size_t bucket(std::uint64_t v) {
+        if (v < linear) return static_cast<std::size_t>(v);
+        unsigned shift = static_cast<unsigned>(63 - __builtin_clzll(v)) - 6;
+        return linear + (shift - 1) * perOctave + static_cast<std::size_t>((v >> shift) - perOctave);
+    }
+
+    static std::uint64_t upperEdge(std::size_t i) {
+        if (i < linear) return i;
+        unsigned shift = static_cast<unsigned>((i - linear) / perOctave) + 1;
+        std::uint64_t mantissa = (i - linear) % perOctave + perOctave;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    std::array<std::uint64_t, buckets> counts_{};
+    std::uint64_t total_{0};
+    std::uint64_t max_{0};
+    std::uint64_t min_{~std::uint64_t{0}};
+};
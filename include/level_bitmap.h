@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hierarchical bitmap over the price ladder: bit i is set when level i has resting orders.
+// Each layer summarises the one below it (one bit per 64-bit word), so finding the next
+// or previous non-empty level is a couple of count-zeros per layer instead of a scan.
+class LevelBitmap {
+public:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    LevelBitmap() = default;
+    explicit LevelBitmap(std::size_t bits) { resize(bits); }
+
+    void resize(std::size_t bits) {
+        layers_.clear();
+        std::size_t words = bits > 64 ? (bits + 63) / 64 : 1;
+        while (true) {
+            layers_.emplace_back(words, 0);
+            if (words == 1) break;
+            words = (words + 63) / 64;
+        }
+        bits_ = bits;
+    }
+
+    std::size_t size() const { return bits_; }
+
+    bool test(std::size_t i) const { return (layers_[0][i >> 6] >> (i & 63)) & 1u; }
+
+    void set(std::size_t i) {
+        for (auto& layer : layers_) {
+            std::uint64_t& word = layer[i >> 6];
+            bool wasEmpty = word == 0;
+            word |= std::uint64_t{1} << (i & 63);
+            if (!wasEmpty) return;
+            i >>= 6;
+        }
+    }
+
+    void clear(std::size_t i) {
+        for (auto& layer : layers_) {
+            std::uint64_t& word = layer[i >> 6];
+            word &= ~(std::uint64_t{1} << (i & 63));
+            if (word != 0) return;
+            i >>= 6;
+        }
+    }
+
+    void reset() {
+        for (auto& layer : layers_) std::fill(layer.begin(), layer.end(), 0);
+    }
+
+    // Smallest set index >= i, or npos.
+    std::size_t next(std::size_t i) const {
+        if (i >= bits_) return npos;
+        std::size_t layer = 0;
+        while (true) {
+            std::size_t w = i >> 6;
+            if (w >= layers_[layer].size()) return npos;
+            std::uint64_t word = layers_[layer][w] & (~std::uint64_t{0} << (i & 63));
+            if (word) {
+                i = (w << 6) + static_cast<std::size_t>(__builtin_ctzll(word));
+                break;
+            }
+            if (++layer == layers_.size()) return npos;
+            i = w + 1;
+        }
+        while (layer > 0) {
+            --layer;
+            i = (i << 6) + static_cast<std::size_t>(__builtin_ctzll(layers_[layer][i]));
+        }
+        return i;
+    }
+
+    // Largest set index <= i, or npos.
+    std::size_t prev(std::size_t i) const {
+        if (i == npos) return npos;
+        if (i >= bits_) i = bits_ - 1;
+        std::size_t layer = 0;
+        while (true) {
+            std::size_t w = i >> 6;
+            unsigned bit = static_cast<unsigned>(i & 63);
+            std::uint64_t mask = bit == 63 ? ~std::uint64_t{0} : (std::uint64_t{1} << (bit + 1)) - 1;
+            std::uint64_t word = layers_[layer][w] & mask;
+            if (word) {
+                i = (w << 6) + 63 - static_cast<std::size_t>(__builtin_clzll(word));
+                break;
+            }
+            if (w == 0 || ++layer == layers_.size()) return npos;
+            i = w - 1;
+        }
+        while (layer > 0) {
+            --layer;
+            i = (i << 6) + 63 - static_cast<std::size_t>(__builtin_clzll(layers_[layer][i]));
+        }
+        return i;
+    }
+
+private:
+    std::vector<std::vector<std::uint64_t>> layers_;
+    std::size_t bits_{0};
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Always-on instrumentation for the server. Every thread that records gets its own block of
+// histograms and counters the first time it touches one, so recording is a couple of plain
+// stores into memory no other thread writes; a scrape walks all the blocks and adds them up.
+// Build with -DORDERBOOK_METRICS=0 (CMake option of the same name) and every call below
+// compiles to nothing.
+#ifndef ORDERBOOK_METRICS
+#define ORDERBOOK_METRICS 1
+#endif
+
+namespace metrics {
+
+// Where a request's time goes. Parse, serialize and write are the HTTP side, queue is ring
+// wait (submit to the shard picking it up), match is the engine, request is read-to-written.
+enum Stage : std::size_t { Parse, Queue, Match, Serialize, Write, Request, stageCount };
+
+enum Counter : std::size_t {
+    LimitOrders, MarketOrders, Cancels, Modifies, BookReads, Stimmies, Clears, Batches, Stops, CandleReads,
+    Fills, FilledQty, Rejected, StopsTriggered, HeapGrowths, HttpRequests, counterCount
+};
+
+// Summed across threads like the counters, but they go down as well as up.
+enum Gauge : std::size_t { Books, RestingOrders, PendingStops, PriceLevels, HttpConnections, gaugeCount };
+
+// Raw timestamp: TSC ticks on x86 (no syscall, no fence), steady_clock ns elsewhere.
+inline std::uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+// Stage timestamps; always 0 when metrics are compiled out.
+inline std::uint64_t now() { return ORDERBOOK_METRICS ? ticks() : 0; }
+
+// Nanoseconds per now() tick, measured against steady_clock during static initialisation.
+extern const double nsPerTick;
+inline std::uint64_t toNs(std::uint64_t ticks) { return static_cast<std::uint64_t>(static_cast<double>(ticks) * nsPerTick); }
+
+// Only ever written by the thread that owns it, so a relaxed load + store is enough and
+// compiles to a plain add; readers on other threads just see a slightly stale value.
+struct Cell {
+    std::atomic<std::uint64_t> value{0};
+    void add(std::uint64_t n) { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    std::uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+// Power-of-two nanosecond buckets: bucket i holds samples in (2^(i-1), 2^i].
+struct StageHistogram {
+    static constexpr std::size_t buckets = 64;
+    std::array<Cell, buckets> counts;
+    Cell sumNs;
+    void record(std::uint64_t ns) {
+        counts[ns > 1 ? 64 - static_cast<std::size_t>(__builtin_clzll(ns - 1)) : 0].add(1);
+        sumNs.add(ns);
+    }
+};
+
+struct ThreadBlock {
+    std::array<StageHistogram, stageCount> stages;
+    std::array<Cell, counterCount> counters;
+    std::array<Cell, gaugeCount> gauges;       // two's complement deltas; the sum is the gauge
+};
+
+// This thread's block, created and registered on first use and kept after the thread exits.
+ThreadBlock& registerThread();
+inline ThreadBlock& local() {
+    static thread_local ThreadBlock* block = nullptr; // constant-initialised, so no TLS init wrapper
+    if (__builtin_expect(block == nullptr, 0)) block = &registerThread();
+    return *block;
+}
+
+#if ORDERBOOK_METRICS
+inline void record(Stage stage, std::uint64_t ticks) { local().stages[stage].record(toNs(ticks)); }
+inline void count(Counter counter, std::uint64_t n = 1) { local().counters[counter].add(n); }
+inline void adjust(Gauge gauge, std::int64_t delta) { local().gauges[gauge].add(static_cast<std::uint64_t>(delta)); }
+#else
+inline void record(Stage, std::uint64_t) {}
+inline void count(Counter, std::uint64_t = 1) {}
+inline void adjust(Gauge, std::int64_t) {}
+#endif
+
+constexpr bool enabled = ORDERBOOK_METRICS != 0;
+
+// Everything above in Prometheus text exposition format (version 0.0.4).
+std::string render();
+
+} // namespace metrics
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Open-addressing OrderId -> slot table (linear probing, backward-shift deletion, so no
+// tombstones). Sized up front with reserve(); inserts and erases never touch the heap
+// until the table passes half full. Ids come from a counter, so they're scattered with a
+// Fibonacci multiply; masking them directly would pack live ids into one long probe run.
+class OrderIndex {
+public:
+    static constexpr std::uint32_t nil = static_cast<std::uint32_t>(-1);
+
+    OrderIndex() { rehash(16); }
+
+    // Room for n live ids without growing.
+    void reserve(std::size_t n) {
+        std::size_t cap = entries_.size();
+        while (cap < n * 2) cap *= 2;
+        if (cap != entries_.size()) rehash(cap);
+    }
+
+    std::size_t size() const { return size_; }
+    std::size_t growths() const { return growths_; }
+
+    void clear() {
+        for (auto& e : entries_) e.id = 0;
+        size_ = 0;
+    }
+
+    // id must not be present; 0 is reserved as the empty marker.
+    void insert(std::uint64_t id, std::uint32_t slot) {
+        if ((size_ + 1) * 2 > entries_.size()) {
+            ++growths_;
+            rehash(entries_.size() * 2);
+        }
+        std::size_t i = home(id);
+        while (entries_[i].id != 0) i = (i + 1) & mask_;
+        entries_[i] = Entry{id, slot};
+        ++size_;
+    }
+
+    // Bulk loaders know ids a few steps ahead; touching their buckets early hides the miss.
+    void prefetch(std::uint64_t id) const { __builtin_prefetch(&entries_[home(id)], 1); }
+
+    std::uint32_t find(std::uint64_t id) const {
+        for (std::size_t i = home(id); entries_[i].id != 0; i = (i + 1) & mask_) {
+            if (entries_[i].id == id) return entries_[i].slot;
+        }
+        return nil;
+    }
+
+    void erase(std::uint64_t id) {
+        std::size_t i = home(id);
+        while (entries_[i].id != id) {
+            if (entries_[i].id == 0) return;
+            i = (i + 1) & mask_;
+        }
+        // Pull later entries of the probe run back into the hole so lookups never stop early.
+        for (std::size_t j = (i + 1) & mask_; entries_[j].id != 0; j = (j + 1) & mask_) {
+            std::size_t h = home(entries_[j].id);
+            bool movable = i <= j ? (h <= i || h > j) : (h <= i && h > j);
+            if (movable) {
+                entries_[i] = entries_[j];
+                i = j;
+            }
+        }
+        entries_[i].id = 0;
+        --size_;
+    }
+
+private:
+    struct Entry {
+        std::uint64_t id;
+        std::uint32_t slot;
+    };
+
+    std::size_t home(std::uint64_t id) const {
+        return static_cast<std::size_t>((id * 0x9E3779B97F4A7C15ull) >> shift_);
+    }
+
+    void rehash(std::size_t cap) {
+        std::vector<Entry> old = std::move(entries_);
+        entries_.assign(cap, Entry{0, nil});
+        mask_ = cap - 1;
+        shift_ = 64;
+        for (std::size_t c = cap; c > 1; c >>= 1) --shift_;
+        size_ = 0;
+        for (const auto& e : old) {
+            if (e.id == 0) continue;
+            std::size_t i = home(e.id);
+            while (entries_[i].id != 0) i = (i + 1) & mask_;
+            entries_[i] = e;
+            ++size_;
+        }
+    }
+
+    std::vector<Entry> entries_;
+    std::size_t mask_{0};
+    unsigned shift_{64};
+    std::size_t size_{0};
+    std::size_t growths_{0};
+};
@@ -1,9 +1,14 @@
 #pragma once
 
-#include <deque>
-#include <map>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <type_traits>
+#include <vector>
 
-using std::deque;
+#include "level_bitmap.h"
+#include "order_index.h"
 
 namespace ansi {
     inline constexpr const char* yellow = "\033[33m";
@@ -15,44 +20,296 @@ namespace ansi {
 
 enum class Side { Buy, Sell };
 
-enum class OrderType { Limit, Market };
+enum class OrderType { Limit, Market, Stop, StopLimit };
 
-struct Order {
-    double price;
-    int quantity;
+using OrderId = std::uint64_t;
+
+// Price and quantity types are template parameters of the book; the plain names below are
+// the double/int book everything else in the repo uses. A fixed-point book (integer prices
+// in the instrument's own units) uses std::int64_t for PriceT.
+template <typename PriceT, typename QtyT>
+struct BasicOrder {
+    OrderId id;
+    PriceT price;
+    QtyT quantity;
     Side side;
     OrderType type;
 };
 
-struct ExecutionResults {
+template <typename QtyT>
+struct BasicExecutionResults {
     bool traded;
-    int filled;
-    int requested;
+    QtyT filled;
+    QtyT requested;
     int trades{0};          // number of executions
     double notional{0.0};   // total traded value for avg price calc
+    bool rejected{false};   // limit price was too far from the book to fit on the ladder
+    int triggered{0};       // stops this call set off, cascades included
+    int stopTrades{0};      // executions those stops made; not in trades/filled, which are this order's
+    QtyT stopFilled{0};
+    OrderId id{0};          // limit orders only; live in the book while anything rests
 };
 
-struct BookLevel {
-    double price; 
-    int qty; 
+template <typename PriceT, typename QtyT>
+struct BasicBookLevel {
+    PriceT price;
+    QtyT qty;
+    int orders{0};
 };
 
-struct BookSnapshot {
-    std::vector<BookLevel> bids;
-    std::vector<BookLevel> asks;
+// Market-data records produced while change capture is on.
+template <typename PriceT, typename QtyT>
+struct BasicLevelUpdate {
+    Side side;
+    PriceT price;
+    QtyT qty;               // 0: the level is gone
+    int orders;
 };
 
+template <typename PriceT, typename QtyT>
+struct BasicTradePrint {
+    PriceT price;
+    QtyT qty;
+    Side aggressor;
+};
 
+// One execution against one resting order, reported as it happens when the book has a
+// fill listener. Market orders have no id, so their fills carry taker 0.
+template <typename PriceT, typename QtyT>
+struct BasicFill {
+    OrderId maker;
+    OrderId taker;
+    PriceT price;
+    QtyT qty;
+    Side aggressor;
+    std::uint64_t seq;      // per book, counts every fill from 1
+};
+
+// One order of a submitBatch() call. Market and stop orders ignore price; only stops use stopPrice.
+template <typename PriceT, typename QtyT>
+struct BasicOrderCommand {
+    Side side;
+    OrderType type;
+    PriceT price;
+    QtyT quantity;
+    PriceT stopPrice;
+};
+
+template <typename PriceT, typename QtyT>
+struct BasicBookSnapshot {
+    std::vector<BasicBookLevel<PriceT, QtyT>> bids;
+    std::vector<BasicBookLevel<PriceT, QtyT>> asks;
+};
+
+using Order = BasicOrder<double, int>;
+using ExecutionResults = BasicExecutionResults<int>;
+using BookLevel = BasicBookLevel<double, int>;
+using LevelUpdate = BasicLevelUpdate<double, int>;
+using TradePrint = BasicTradePrint<double, int>;
+using Fill = BasicFill<double, int>;
+using OrderCommand = BasicOrderCommand<double, int>;
+using BookSnapshot = BasicBookSnapshot<double, int>;
+
+// Fill listeners are a template parameter of the book, so reporting costs a direct
+// (usually inlined) call and nothing at all with this one. A listener is any type with
+// `void onFill(const Fill&)` for the book's Fill; see fill_listener.h for one that queues
+// fills in a ring.
+struct NoFillListener {
+    template <typename F>
+    void onFill(const F&) {}
+};
+
+struct BookConfig {
+    double tickSize{0.01};                // prices are snapped to whole ticks of this size (a whole number for integer prices)
+    std::size_t ladderTicks{4096};        // initial width of the price ladder, centred on the first order
+    std::size_t maxLadderTicks{1u << 20}; // the ladder never grows past this; limits further out are rejected
+    std::size_t reserveOrders{0};         // resting-order slots (and id index room) to allocate up front
+};
+
+// The member functions are compiled once in orderbook.cpp for each combination instantiated
+// at the bottom of it; a new price/qty type or listener needs a line there.
+template <typename PriceT = double, typename QtyT = int, typename Listener = NoFillListener>
+class basic_orderbook {
+    static_assert(std::is_arithmetic_v<PriceT> && std::is_signed_v<PriceT>, "prices are signed numbers");
+    static_assert(std::is_integral_v<QtyT> && std::is_signed_v<QtyT>, "quantities are signed integers");
 
-class orderbook {
 public:
+    using Order = BasicOrder<PriceT, QtyT>;
+    using ExecutionResults = BasicExecutionResults<QtyT>;
+    using BookLevel = BasicBookLevel<PriceT, QtyT>;
+    using LevelUpdate = BasicLevelUpdate<PriceT, QtyT>;
+    using TradePrint = BasicTradePrint<PriceT, QtyT>;
+    using Fill = BasicFill<PriceT, QtyT>;
+    using OrderCommand = BasicOrderCommand<PriceT, QtyT>;
+    using BookSnapshot = BasicBookSnapshot<PriceT, QtyT>;
+
+    // Only for listeners that work without setup; a RingFillBook has to be given its queue.
+    template <typename L = Listener, typename = std::enable_if_t<std::is_default_constructible_v<L>>>
+    basic_orderbook() : basic_orderbook(defaultConfig()) {}
+    explicit basic_orderbook(const BookConfig& config, Listener listener = Listener{});
     void printBook();
-    ExecutionResults addLimitOrder(double price, int quantity, Side side);
-    ExecutionResults addMarketOrder(int quantity, Side side);
+    ExecutionResults addLimitOrder(PriceT price, QtyT quantity, Side side);
+    ExecutionResults addMarketOrder(QtyT quantity, Side side);
+    // Stops wait off the book until a trade prints at or through stopPrice (at or above it
+    // for a buy, at or below for a sell), then go in as a market order, or for a stop-limit
+    // as a limit at `price`, keeping their id. Stops set off by the same prints go in the
+    // order they were placed, and whatever those trade can set off more. Only trades after
+    // a stop is placed count. cancel() takes a waiting stop out; modify() doesn't see them.
+    ExecutionResults addStopOrder(PriceT stopPrice, QtyT quantity, Side side);
+    ExecutionResults addStopLimitOrder(PriceT stopPrice, PriceT price, QtyT quantity, Side side);
+    // Runs count orders in order, with exactly the outcome of that many addLimitOrder /
+    // addMarketOrder calls, and writes order i's result to results[i]. The ladder is fitted
+    // to the whole batch's price range and the slot pool sized for it before the first one,
+    // so a batch goes to the heap at most once instead of whenever an order lands outside.
+    void submitBatch(const OrderCommand* orders, std::size_t count, ExecutionResults* results);
+    bool cancel(OrderId id);
+    // Shrinking keeps time priority; a new price or a bigger size requeues (and may trade).
+    // nullopt if the id isn't resting.
+    std::optional<ExecutionResults> modify(OrderId id, QtyT newQuantity);
+    std::optional<ExecutionResults> modify(OrderId id, QtyT newQuantity, PriceT newPrice);
     BookSnapshot snapshot(std::size_t depth) const;
+    void snapshot(std::size_t depth, BookSnapshot& out) const; // reuses out's capacity
+    std::optional<BookLevel> bestBid() const;
+    std::optional<BookLevel> bestAsk() const;
+    std::optional<PriceT> spread() const;
+    double tickSize() const { return 1.0 / ticksPerUnit_; }
+    // Empty the book but keep the ladder, slot pool and index allocated. Ids keep counting.
+    void clear();
+    // Pre-size the slot pool and id index so up to `orders` resting orders never allocate.
+    void reserve(std::size_t orders);
+    // Times the order path had to go to the heap (pool, index or ladder growth).
+    // Stays at zero while the book fits in what was reserved.
+    std::size_t heapGrowths() const { return growths_ + index_.growths(); }
+    std::size_t orderCount() const { return index_.size() - stopCount_; } // resting limits
+    std::size_t stopCount() const { return stopCount_; }                    // stops still waiting
+    std::size_t levelCount() const { return levels_; }  // occupied price levels, both sides
+    // Goes up whenever a level changes (or the book is cleared or restored), so equal
+    // versions mean an identical book and a cached snapshot of it is still good.
+    std::uint64_t version() const { return version_; }
+    // Change capture for market data, off by default. While on, the book remembers which
+    // levels it touched and every trade; takeChanges() appends the current state of each
+    // touched level (once, bids then asks) plus the trades in order, then forgets them.
+    // Returns false if nothing changed since the last call.
+    void captureChanges(bool on);
+    bool takeChanges(std::vector<LevelUpdate>& levels, std::vector<TradePrint>& trades);
+    // Binary image of the whole book: id counter plus every resting order, level by level in
+    // queue order, then the waiting stops. save() appends to out. restore() replaces the book with an image in one
+    // pass, keeping price/time priority; false (book left empty) if the image is damaged or
+    // was taken with a different tick size.
+    void save(std::vector<char>& out) const;
+    bool restore(const char* data, std::size_t size);
+    Listener& listener() { return listener_; }
 private:
-    std::map<double, deque<Order>, std::greater<double>> buys_; // descending: best bid first
-    std::map<double, deque<Order>, std::less<double>> sells_;   // ascending: best ask first
-};
+    static constexpr bool reportsFills = !std::is_same_v<Listener, NoFillListener>;
+    static constexpr bool fixedPoint = std::is_integral_v<PriceT>;
+    static constexpr std::size_t npos = LevelBitmap::npos;
+    static constexpr std::uint32_t nil = static_cast<std::uint32_t>(-1);
+    // Ticks further out than this are rejected before any ladder arithmetic, which keeps
+    // every tick difference and base offset well inside int64.
+    static constexpr std::int64_t maxTick = std::int64_t{1} << 52;
+    static bool tickOk(std::int64_t tick) { return tick >= -maxTick && tick <= maxTick; }
+    // BookConfig's 0.01 tick suits double prices; integer prices default to a tick of 1.
+    static BookConfig defaultConfig() {
+        BookConfig config;
+        if constexpr (fixedPoint) config.tickSize = 1.0;
+        return config;
+    }
+
+    // Resting order slot. Slots live in nodes_ and are chained into their level's FIFO,
+    // so an order can be unlinked from the middle of a queue without searching for it.
+    struct OrderNode {
+        Order order;
+        std::int64_t tick;
+        std::uint32_t prev;
+        std::uint32_t next;
+    };
 
+    // Running totals are kept in step with every rest/fill/cancel so readers never walk the queue.
+    struct PriceLevel {
+        std::uint32_t head{nil};
+        std::uint32_t tail{nil};
+        QtyT quantity{0};
+        int orders{0};
+        bool empty() const { return head == nil; }
+    };
+
+    std::int64_t toTick(PriceT price) const; // out-of-range prices come back just past maxTick
+    PriceT tickPrice(std::int64_t tick) const {
+        if constexpr (fixedPoint) return static_cast<PriceT>(tick * tick_);
+        else return static_cast<PriceT>(tick) / ticksPerUnit_;
+    }
+    PriceT toPrice(std::size_t idx) const { return tickPrice(baseTick_ + static_cast<std::int64_t>(idx)); }
+    bool fitTick(std::int64_t tick) { return fitTicks(tick, tick); }
+    bool fitTicks(std::int64_t low, std::int64_t high);
+    BookLevel levelAt(std::size_t idx) const { return {toPrice(idx), ladder_[idx].quantity, ladder_[idx].orders}; }
+    ExecutionResults place(OrderId id, PriceT price, QtyT quantity, Side side);
+    ExecutionResults market(OrderId id, QtyT quantity, Side side);
+    ExecutionResults placeStop(OrderType type, PriceT stopPrice, PriceT price, QtyT quantity, Side side);
+    void fireStops(ExecutionResults& results);
+    void pushStop(Side side, std::int64_t tick, OrderId id);
+    void compactStops();
+    // The matching kernel, compiled once per taker side; Market drops the price limit.
+    template <Side Taker, bool Market>
+    void sweep(OrderId takerId, QtyT& quantity, std::size_t limitIdx, ExecutionResults& results);
+    std::uint32_t takeSlot();
+    void rest(std::int64_t tick, const Order& o);
+    template <Side S>
+    void unlink(std::uint32_t slot);
+    void unlink(std::uint32_t slot);    // side read from the node
+    void releaseSlot(std::uint32_t slot);
+    void touch(Side side, std::int64_t tick) {
+        ++version_;
+        if (capture_) touched_.push_back({tick, side});
+    }
+
+    double ticksPerUnit_;
+    std::int64_t tick_;                 // tick size in price units, fixed-point books only
+    std::size_t maxLadderTicks_;
+    std::int64_t baseTick_{0};          // tick of ladder_[0]
+    std::vector<PriceLevel> ladder_;    // one slot per tick; a slot holds bids or asks, never both
+    LevelBitmap bidLevels_;
+    LevelBitmap askLevels_;
+    std::size_t bestBid_{npos};         // ladder index of the best bid/ask, npos when that side is empty
+    std::size_t bestAsk_{npos};
+    std::vector<OrderNode> nodes_;      // pool of order slots; free ones are chained from freeSlot_
+    std::uint32_t freeSlot_{nil};
+    OrderIndex index_;                  // resting order id -> slot
+    OrderId nextId_{1};
+    std::size_t growths_{0};
+    std::size_t levels_{0};
+    std::uint64_t version_{0};
+
+    struct Touch {
+        std::int64_t tick;
+        Side side;
+    };
+    bool capture_{false};
+    std::vector<Touch> touched_;        // may repeat; deduplicated in takeChanges
+    std::vector<TradePrint> trades_;
+
+    // Waiting stops live in nodes_ and index_ like resting orders (tick is the stop tick),
+    // but not on the ladder: each side has a heap of (tick, id) with the next stop to go
+    // on top, so a trade only has to look at the top. Cancelled stops are left in the heap
+    // and skipped when they surface (their id is gone from the index); compactStops()
+    // clears them out once they outnumber the live ones.
+    struct StopEntry {
+        std::int64_t tick;
+        OrderId id;
+    };
+    std::vector<StopEntry> buyStops_;   // lowest stop on top
+    std::vector<StopEntry> sellStops_;  // highest stop on top
+    std::size_t stopCount_{0};
+    std::vector<std::uint32_t> firing_; // slots of the stops being set off
+    // Lowest and highest tick traded since the stops were last looked at; low > high: none.
+    std::int64_t tradeLow_{std::numeric_limits<std::int64_t>::max()};
+    std::int64_t tradeHigh_{std::numeric_limits<std::int64_t>::min()};
+
+    Listener listener_;
+    std::uint64_t fillSeq_{0};
+};
 
+extern template class basic_orderbook<double, int, NoFillListener>;
+extern template class basic_orderbook<std::int64_t, std::int64_t, NoFillListener>;
+using orderbook = basic_orderbook<double, int>;
+// Integer prices in the instrument's own units (tickSize a whole number of them) and 64-bit sizes.
+using FixedPointBook = basic_orderbook<std::int64_t, std::int64_t>;
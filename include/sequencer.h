@@ -0,0 +1,170 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "candles.h"
+#include "journal.h"
+#include "orderbook.h"
+#include "spsc_ring.h"
+#include "symbol.h"
+
+// Everything the matching thread fills in for one command. Lives in the requesting
+// connection, so the snapshot vectors keep their capacity between requests.
+struct EngineReply {
+    ExecutionResults exec{};
+    bool found{true};                 // cancel/modify: the id was resting
+    BookSnapshot book;
+    std::optional<double> spread;
+    std::uint64_t bookSeq{0};         // book: seq of the last BookUpdate the snapshot includes
+    std::uint64_t bookVersion{0};     // book: orderbook::version() the snapshot was taken at
+    std::vector<ExecutionResults> results; // batch: one per order
+    std::vector<Candle> candles;      // candles: oldest first
+    long long matchNs{0};
+};
+
+// Whoever submits a command. The matching thread writes reply and then calls engineDone()
+// from its own thread; the implementation is responsible for hopping back to its executor.
+class EngineClient {
+public:
+    EngineReply reply;
+    std::vector<OrderCommand> orders; // batch: what to run, far too many to ride in the command
+    virtual void engineDone() = 0;
+protected:
+    ~EngineClient() = default;
+};
+
+// One book's level changes and trades since its previous update. Levels carry their new
+// absolute state, so applying an update twice is harmless.
+struct BookUpdate {
+    Symbol symbol;
+    std::uint64_t seq{0};             // per book: 1, 2, 3...
+    std::vector<LevelUpdate> levels;
+    std::vector<TradePrint> trades;
+};
+
+// Market data out of the shards. publish() runs on a matching thread, at most once per
+// book per pass over the rings, so a burst of commands coalesces into one update.
+class MarketFeed {
+public:
+    virtual void publish(std::shared_ptr<const BookUpdate> update) = 0;
+    // Also on a matching thread, before building an update: false skips it (and its seq).
+    // Must turn true before the feed asks for the snapshot it will follow up on.
+    virtual bool wants(const Symbol&) const { return true; }
+protected:
+    ~MarketFeed() = default;
+};
+
+struct EngineCommand {
+    enum class Kind : std::uint8_t { Limit, Market, Cancel, Modify, Book, Stimmy, Clear, Batch, Stop, Candles };
+    Kind kind;
+    Side side;
+    bool hasPrice;          // modify: move the order as well as resize it; stop: a stop-limit at price
+    int qty;
+    double price;
+    OrderId id;             // ids are per symbol; candles: the interval in seconds
+    std::size_t depth;      // book: levels; candles: bars
+    Symbol symbol;
+    EngineClient* client;   // nullptr: fire and forget, no reply (batches always have one)
+    std::uint64_t queuedAt{0}; // metrics::now() at submit, for the queue stage
+    double stopPrice{0.0};  // stop
+};
+
+// Books are split across shards by symbol hash. Each shard is one matching thread that
+// exclusively owns its books, so no book is ever touched from two threads and nothing
+// needs a lock. Every I/O thread owns one SPSC ring per shard and is its only producer;
+// a shard drains its rings in batches, runs the commands and hands replies back.
+class Sequencer {
+public:
+    static constexpr std::size_t ringCapacity = 4096;
+    static constexpr std::size_t batchSize = 64;
+
+    // Books are created on first use with `bookConfig`. firstCpu >= 0 pins shard i to
+    // core firstCpu + i.
+    Sequencer(const BookConfig& bookConfig, std::size_t shards, std::size_t producers, int firstCpu = -1);
+    ~Sequencer();
+    Sequencer(const Sequencer&) = delete;
+    Sequencer& operator=(const Sequencer&) = delete;
+
+    // Where each pass's book updates go. Call before start().
+    void setFeed(MarketFeed* feed) { feed_ = feed; }
+    // Every state-changing command gets appended (producer = shard index) once it has run.
+    // The journal needs shardCount() producers. Call before start().
+    void setJournal(Journal* journal) { journal_ = journal; }
+    // Off for a shadow copy of the books (the snapshot replica), so /metrics only counts the
+    // live ones. Call before start().
+    void setMetrics(bool on) { metrics_ = on; }
+    // Run a command on the calling thread, e.g. to replay a journal. Only before start(). The
+    // trades it makes don't go into candles, and it isn't counted in the metrics, bar the gauges.
+    void apply(const EngineCommand& cmd);
+    // Replace (or create) a symbol's book from an orderbook::save() image. Only before start().
+    bool restoreBook(const Symbol& symbol, const char* data, std::size_t size);
+    // Visit every book. Only while the shards aren't running.
+    void forEachBook(const std::function<void(const Symbol&, const orderbook&)>& fn) const;
+    void start();
+    void stop();
+
+    // Only ever call with the same `producer` from the same thread. Spins while the
+    // target shard's ring is full.
+    void submit(std::size_t producer, const EngineCommand& cmd);
+
+    std::size_t shardCount() const { return shards_.size(); }
+    std::size_t shardOf(const Symbol& symbol) const { return SymbolHash{}(symbol) % shards_.size(); }
+    // Commands executed so far across all shards.
+    std::uint64_t processed() const;
+    // A book's orderbook::version() as of its last command, from any thread and without a
+    // trip through the rings. 0 for a book that doesn't exist yet, which reads the same
+    // (empty) as a new one.
+    std::uint64_t bookVersion(const Symbol& symbol) const;
+
+private:
+    struct Book {
+        explicit Book(const BookConfig& config) : book(config) {}
+        orderbook book;
+        std::uint64_t seq{0};         // last published update
+        bool dirty{false};            // queued in Shard::dirty
+        std::atomic<std::uint64_t> version{0}; // book.version(), for readers on other threads
+        CandleSet candles;            // fed from the trades at each publish(), feed or not
+    };
+    using BookMap = std::unordered_map<Symbol, Book, SymbolHash>;
+
+    struct Shard {
+        std::size_t index{0};
+        std::vector<std::unique_ptr<SpscRing<EngineCommand, ringCapacity>>> rings; // one per producer
+        BookMap books;
+        mutable std::shared_mutex booksMutex; // the shard holds it to add a book, bookVersion() to look one up
+        std::vector<BookMap::value_type*> dirty; // books changed during this pass
+        std::atomic<std::uint64_t> processed{0};
+        std::thread thread;
+    };
+
+    void loop(Shard& shard);
+    void execute(Shard& shard, const EngineCommand& cmd);
+    void publish(BookMap::value_type& entry);
+    void record(Shard& shard, EngineCommand::Kind kind, Side side, bool hasPrice, int qty, double price, OrderId id,
+                const Symbol& symbol);
+    void recordOrders(Shard& shard, const std::vector<OrderCommand>& orders, const Symbol& symbol);
+
+    BookConfig bookConfig_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    int firstCpu_;
+    MarketFeed* feed_{nullptr};
+    Journal* journal_{nullptr};
+    bool metrics_{true};
+    std::atomic<bool> running_{false};
+};
+
+// Turn a journal record back into the command that produced it. Stops keep their stop
+// price's bits in the record's id field, which they otherwise wouldn't use.
+EngineCommand replayCommand(const JournalRecord& record);
+
+// Producer slot for the calling thread; each I/O thread sets its own before running handlers.
+extern thread_local std::size_t ioThread;
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sequencer.h"
+
+// Whole-server snapshot: every book's orderbook::save() image plus how many journal bytes
+// those books already reflect. Startup restores it and only replays the journal past that.
+struct SnapshotBook {
+    Symbol symbol;
+    const char* data;
+    std::size_t size;
+};
+
+// A snapshot file mapped read-only; the book views stay valid while this lives.
+class SnapshotFile {
+public:
+    SnapshotFile() = default;
+    ~SnapshotFile();
+    SnapshotFile(const SnapshotFile&) = delete;
+    SnapshotFile& operator=(const SnapshotFile&) = delete;
+
+    // False if there's no file; throws std::runtime_error if it's there but unreadable.
+    bool open(const std::string& path);
+    std::uint64_t journalOffset() const { return journalOffset_; }
+    const std::vector<SnapshotBook>& books() const { return books_; }
+
+private:
+    void* map_{nullptr};
+    std::size_t size_{0};
+    std::uint64_t journalOffset_{0};
+    std::vector<SnapshotBook> books_;
+};
+
+// Writes every book in `books` to path.tmp, syncs it and renames it over path, so a crash
+// mid-write leaves the previous snapshot in place. Throws std::runtime_error on I/O errors.
+void writeSnapshot(const std::string& path, std::uint64_t journalOffset, const Sequencer& books);
+
+// Takes snapshots without touching the matching threads: it keeps its own replica of every
+// book by tailing the journal file, and every `interval` writes the replica out if it has
+// moved. Anything the replica can see has already left the shards through the journal.
+class Snapshotter {
+public:
+    Snapshotter(const BookConfig& config, std::string journalPath, std::string snapshotPath, std::chrono::seconds interval);
+    ~Snapshotter();
+
+    // seed: build the replica from the existing snapshot (pass false if startup ignored it).
+    void start(bool seed);
+    // Catches up with the journal one last time and writes a final snapshot. Stop the
+    // journal first so everything is in the file.
+    void stop();
+
+private:
+    void loop(bool seed);
+    void catchUp();
+    void write();
+
+    Sequencer replica_;
+    std::string journalPath_;
+    std::string snapshotPath_;
+    std::chrono::seconds interval_;
+    int journalFd_{-1};
+    std::uint64_t offset_{0};       // journal bytes applied to the replica
+    std::uint64_t written_{0};      // offset_ of the last snapshot written
+    std::vector<char> buffer_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_{false};
+    std::thread thread_;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Bounded single-producer/single-consumer ring. One thread pushes, one thread consumes;
+// each side keeps a cached copy of the other's index so the shared cache line is only
+// read when the ring looks full (producer) or empty (consumer).
+template <typename T, std::size_t Capacity>
+class SpscRing {
+    static_assert(Capacity && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    // Producer side. False when the ring is full.
+    bool tryPush(const T& value) {
+        std::size_t head = head_.load(std::memory_order_relaxed);
+        if (head - cachedTail_ == Capacity) {
+            cachedTail_ = tail_.load(std::memory_order_acquire);
+            if (head - cachedTail_ == Capacity) return false;
+        }
+        slots_[head & (Capacity - 1)] = value;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Hands up to `max` queued items to fn in order and releases them
+    // back to the producer in one store. Returns how many were consumed.
+    template <typename F>
+    std::size_t consume(std::size_t max, F&& fn) {
+        std::size_t tail = tail_.load(std::memory_order_relaxed);
+        if (cachedHead_ == tail) {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+            if (cachedHead_ == tail) return 0;
+        }
+        std::size_t n = cachedHead_ - tail;
+        if (n > max) n = max;
+        for (std::size_t i = 0; i < n; ++i) fn(slots_[(tail + i) & (Capacity - 1)]);
+        tail_.store(tail + n, std::memory_order_release);
+        return n;
+    }
+
+private:
+    alignas(64) std::atomic<std::size_t> head_{0};
+    std::size_t cachedTail_{0};   // producer's view of tail_
+    alignas(64) std::atomic<std::size_t> tail_{0};
+    std::size_t cachedHead_{0};   // consumer's view of head_
+    alignas(64) std::array<T, Capacity> slots_{};
+};
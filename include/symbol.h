@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Instrument name stored inline (up to 15 chars, zero padded) so it can ride inside
+// fixed-size commands and be compared/hashed without touching the heap.
+struct Symbol {
+    static constexpr std::size_t maxLength = 15;
+    std::array<char, maxLength + 1> text{};
+
+    // Letters, digits, '.', '-' and '_' only.
+    static bool parse(std::string_view s, Symbol& out) {
+        if (s.empty() || s.size() > maxLength) return false;
+        out.text.fill('\0');
+        for (std::size_t i = 0; i < s.size(); ++i) {
+            unsigned char c = static_cast<unsigned char>(s[i]);
+            if (!std::isalnum(c) && c != '.' && c != '-' && c != '_') return false;
+            out.text[i] = static_cast<char>(c);
+        }
+        return true;
+    }
+
+    static Symbol fallback() {
+        Symbol s;
+        parse("DEFAULT", s);
+        return s;
+    }
+
+    std::string_view view() const {
+        std::size_t n = 0;
+        while (n < maxLength && text[n]) ++n;
+        return {text.data(), n};
+    }
+
+    bool operator==(const Symbol& other) const { return text == other.text; }
+    bool operator!=(const Symbol& other) const { return text != other.text; }
+};
+
+// FNV-1a over the padded bytes.
+struct SymbolHash {
+    std::size_t operator()(const Symbol& s) const {
+        std::uint64_t h = 1469598103934665603ull;
+        for (char c : s.text) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 1099511628211ull;
+        }
+        return static_cast<std::size_t>(h);
+    }
+};
@@ -6,6 +6,7 @@
 #include <random>
 
 #include "orderbook.h"
+#include "alloc_counter.h"
 
 using std::cin;
 using std::cout;
@@ -23,6 +24,7 @@ void runDaStimmy (orderbook& o) {
     std::uniform_int_distribution<int> sideDist(0, 1);
     std::uniform_int_distribution<int> typeDist(0, 4);  // 0 - 3 will be limit, 4 will be market
 
+    std::size_t allocsBefore = heapAllocations();
     auto start = std::chrono::high_resolution_clock::now();
     for (int i = 0 ; i < 1000 ; ++i) {
         Side side = sideDist(rng) ? Side::Buy : Side::Sell;
@@ -33,9 +35,10 @@ void runDaStimmy (orderbook& o) {
         }
     }
     auto end = std::chrono::high_resolution_clock::now();
+    std::size_t allocs = heapAllocations() - allocsBefore;
     auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
     string time = std::to_string(elapsed);
-    lastTradeMessage += std::to_string(elapsed) + " nanoseconds";
+    lastTradeMessage += std::to_string(elapsed) + " nanoseconds, " + std::to_string(allocs) + " heap allocations";
 }
 
 void fillSome(orderbook& o) {
@@ -51,7 +54,10 @@ void fillSome(orderbook& o) {
 
 
 int main() {
-    orderbook ob;
+    BookConfig config;
+    config.ladderTicks = 8192;      // 95-125 stimmy range fits without regrowing
+    config.reserveOrders = 1 << 16;
+    orderbook ob{config};
 
     while (true) {
         if (cin.eof()) {
@@ -71,6 +77,7 @@ int main() {
         cout << "3. Run the Stimmy\n";
         cout << "4. Fill some\n";
         cout << "5. Empty the book\n";
+        cout << "6. Cancel Order\n";
         cout << "Choice: ";
 
         int choice;
@@ -90,7 +97,7 @@ int main() {
         }
 
         if (choice == 5) {
-            ob = orderbook{};
+            ob.clear();
             lastTradeMessage = "";
         }
 
@@ -98,6 +105,13 @@ int main() {
             break;
         }
 
+        if (choice == 6) {
+            OrderId id;
+            cout << "\nEnter order id: ";
+            cin >> id;
+            lastTradeMessage = ob.cancel(id) ? "Cancelled order #" + std::to_string(id) + "." : "No resting order with that id.";
+        }
+
         if (choice == 1 ) { // limit
             int choice;
             cout << "1. Buy\n2. Sell \nChoice: "; 
@@ -123,6 +137,9 @@ int main() {
             } else {
                 lastTradeMessage = "No trades were made. ";
             }
+            if (result.filled < result.requested && !result.rejected) {
+                lastTradeMessage += "\nResting as order #" + std::to_string(result.id) + ".";
+            }
             
         } else if (choice == 2) { // market
             int choice;
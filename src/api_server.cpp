@@ -1,209 +1,520 @@
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
+#include <boost/beast/websocket.hpp>
 #include <boost/asio.hpp>
 #include <boost/config.hpp>
-#include <fstream>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <charconv>
+#include <filesystem>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <string>
-#include <sstream>
-#include <chrono>
-#include <random>
+#include <thread>
+#include <vector>
 #include <cctype>
+#include "binary_gateway.h"
+#include "book_stream.h"
+#include "http_cache.h"
+#include "json.h"
+#include "metrics.h"
 #include "orderbook.h"
+#include "sequencer.h"
+#include "snapshot.h"
 
 using tcp = boost::asio::ip::tcp;
 namespace http = boost::beast::http;
 
+// One HTTP/1.1 connection. It keeps reading requests until the client closes, sends
+// Connection: close or goes quiet for the idle timeout, and reads ahead while earlier
+// requests are still at the engine (pipelining), up to maxPipeline of them. Each request
+// gets a slot; requests that touch the book become EngineCommands pushed to the sequencer,
+// the matching thread fills the slot's reply and engineDone() bounces back onto the
+// connection's strand to serialise it. Responses go out strictly in request order.
 class BookHandler : public std::enable_shared_from_this<BookHandler> {
 public:
-    BookHandler(tcp::socket socket, orderbook& ob) : socket_(std::move(socket)), ob_(ob) {}
+    static constexpr std::size_t maxPipeline = 16;
+    static constexpr std::size_t maxBookDepth = 1000;
+    static constexpr std::size_t maxBatchOrders = 10000;
+
+    BookHandler(tcp::socket socket, Sequencer& engine, StreamHub& hub, BookCache& cache, const StaticAssets& assets,
+                std::chrono::seconds idleTimeout)
+        : stream_(std::move(socket)), engine_(engine), hub_(hub), cache_(cache), assets_(assets), idleTimeout_(idleTimeout) {
+        boost::system::error_code ec;
+        stream_.socket().set_option(tcp::no_delay(true), ec);
+        open_.fetch_add(1, std::memory_order_relaxed);
+        metrics::adjust(metrics::HttpConnections, 1);
+    }
+    ~BookHandler() {
+        open_.fetch_sub(1, std::memory_order_relaxed);
+        metrics::adjust(metrics::HttpConnections, -1);
+    }
+
     void run() { read(); }
+
+    // Over the connection limit: answer 503 and hang up.
+    void refuse() {
+        Slot& slot = slots_[0];
+        count_ = 1;
+        slot.readAt = metrics::now();
+        slot.res.version(11);
+        slot.res.set(http::field::server, "beast-orderbook");
+        slot.res.keep_alive(false);
+        fail(slot.res, http::status::service_unavailable, "too many connections");
+        slot.res.prepare_payload();
+        slot.ready = true;
+        write();
+    }
+
+    // Connections currently open, across every I/O thread.
+    static int open() { return open_.load(std::memory_order_relaxed); }
+
 private:
-    tcp::socket socket_;
+    // One request, from read until its response is written.
+    struct Slot : EngineClient {
+        std::shared_ptr<BookHandler> owner; // keeps the connection alive while the engine holds us
+        http::response<http::string_body> res;
+        EngineCommand::Kind kind{};
+        OrderId id{0};
+        Symbol symbol;                      // book: what the reply gets cached under
+        std::size_t depth{0};
+        std::uint64_t readAt{0};            // metrics::now() when the request was read
+        bool ready{false};                  // res is complete and can be written
+
+        void engineDone() override {
+            auto self = std::move(owner);
+            boost::asio::post(self->stream_.get_executor(), [self, this] { self->respond(*this); });
+        }
+    };
+
+    inline static std::atomic<int> open_{0};
+
+    boost::beast::tcp_stream stream_;
     boost::beast::flat_buffer buffer_;
     http::request<http::string_body> req_;
-    orderbook& ob_;
+    Sequencer& engine_;
+    StreamHub& hub_;
+    BookCache& cache_;
+    const StaticAssets& assets_;
+    std::chrono::seconds idleTimeout_;
+    std::array<Slot, maxPipeline> slots_;
+    std::size_t head_{0};                   // oldest request still owed a response
+    std::size_t count_{0};
+    std::optional<Symbol> upgrade_;         // /stream requested; hand the socket over once the earlier replies are out
+    bool reading_{false};
+    bool writing_{false};
+    bool eof_{false};                       // no more requests are coming
+    bool closed_{false};
 
     template <typename Resp>
     void addCors(Resp& res) {
         res.set(http::field::access_control_allow_origin, "*");
-        res.set(http::field::access_control_allow_methods, "GET, POST, OPTIONS");
+        res.set(http::field::access_control_allow_methods, "GET, POST, PATCH, DELETE, OPTIONS");
         res.set(http::field::access_control_allow_headers, "Content-Type");
     }
 
-    static bool extractString(const std::string& body, const std::string& key, std::string& out) {
-        auto pos = body.find("\"" + key + "\"");
-        if (pos == std::string::npos) return false;
-        pos = body.find(':', pos);
-        if (pos == std::string::npos) return false;
-        ++pos;
-        while (pos < body.size() && std::isspace(static_cast<unsigned char>(body[pos]))) ++pos;
-        if (pos >= body.size() || body[pos] != '"') return false;
-        auto end = body.find('"', pos + 1);
-        if (end == std::string::npos) return false;
-        out = body.substr(pos + 1, end - pos - 1);
-        return true;
+    // "/orders/42?symbol=X" -> "/orders/42"
+    static boost::beast::string_view pathOf(boost::beast::string_view target) {
+        return target.substr(0, target.find('?'));
+    }
+
+    // Value of `key` in the query string, if it's there.
+    static bool queryParam(boost::beast::string_view target, boost::beast::string_view key, boost::beast::string_view& out) {
+        auto q = target.find('?');
+        while (q != boost::beast::string_view::npos) {
+            auto start = q + 1;
+            auto end = target.find('&', start);
+            auto pair = target.substr(start, end == boost::beast::string_view::npos ? boost::beast::string_view::npos : end - start);
+            if (pair.size() > key.size() && pair.substr(0, key.size()) == key && pair[key.size()] == '=') {
+                out = pair.substr(key.size() + 1);
+                return true;
+            }
+            q = end;
+        }
+        return false;
+    }
+
+    // ?symbol=..., DEFAULT when absent; false if it's malformed.
+    bool querySymbol(Symbol& out) const {
+        boost::beast::string_view text;
+        if (!queryParam(req_.target(), "symbol", text)) {
+            out = Symbol::fallback();
+            return true;
+        }
+        return Symbol::parse(std::string_view(text.data(), text.size()), out);
+    }
+
+    // POST /orders takes its symbol from the body instead; absent means DEFAULT there too.
+    static bool bodySymbol(std::string_view text, Symbol& out) {
+        if (text.empty()) {
+            out = Symbol::fallback();
+            return true;
+        }
+        return Symbol::parse(text, out);
+    }
+
+    // Beast has its own string_view.
+    std::string_view header(http::field name) const {
+        auto value = req_[name];
+        return {value.data(), value.size()};
+    }
+
+    // ?depth=..., 10 when absent; false unless it's 1 to maxBookDepth.
+    bool queryDepth(std::size_t& out) const {
+        boost::beast::string_view text;
+        out = 10;
+        if (!queryParam(req_.target(), "depth", text)) return true;
+        auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), out);
+        return ec == std::errc() && end == text.data() + text.size() && out >= 1 && out <= maxBookDepth;
     }
 
-    static bool extractNumber(const std::string& body, const std::string& key, double& out) {
-        auto pos = body.find("\"" + key + "\"");
-        if (pos == std::string::npos) return false;
-        pos = body.find(':', pos);
-        if (pos == std::string::npos) return false;
-        ++pos;
-        while (pos < body.size() && std::isspace(static_cast<unsigned char>(body[pos]))) ++pos;
-        char* endPtr = nullptr;
-        out = std::strtod(body.c_str() + pos, &endPtr);
-        return endPtr != body.c_str() + pos;
+    // ?interval=60 (seconds) or 1s/10s/1m/5m/1h, default 1m, and ?n=, default 100: false
+    // unless the interval is one CandleSet keeps and n is 1..CandleSeries::capacity.
+    bool queryCandles(std::int64_t& interval, std::size_t& n) const {
+        boost::beast::string_view text;
+        interval = 60;
+        n = 100;
+        if (queryParam(req_.target(), "interval", text)) {
+            auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), interval);
+            // nothing we serve is longer than the last interval, and anything bigger could overflow the scaling
+            if (ec != std::errc() || interval < 1 || interval > CandleSet::intervals.back()) return false;
+            auto unit = text.substr(static_cast<std::size_t>(end - text.data()));
+            if (unit == "m") interval *= 60;
+            else if (unit == "h") interval *= 3600;
+            else if (!unit.empty() && unit != "s") return false;
+        }
+        if (std::find(CandleSet::intervals.begin(), CandleSet::intervals.end(), interval) == CandleSet::intervals.end()) return false;
+        if (!queryParam(req_.target(), "n", text)) return true;
+        auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), n);
+        return ec == std::errc() && end == text.data() + text.size() && n >= 1 && n <= CandleSeries::capacity;
+    }
+
+    template <typename Resp>
+    static void fail(Resp& res, http::status status, std::string_view error) {
+        res.result(status);
+        res.set(http::field::content_type, "application/json");
+        json::Writer(res.body()) << "{\"error\":\"" << error << "\"}";
+    }
+
+    // "/orders/42" -> 42
+    static bool extractOrderId(boost::beast::string_view target, OrderId& out) {
+        auto digits = pathOf(target).substr(std::string("/orders/").size());
+        if (digits.empty() || digits.size() > 19) return false;
+        out = 0;
+        for (char c : digits) {
+            if (!std::isdigit(static_cast<unsigned char>(c))) return false;
+            out = out * 10 + static_cast<OrderId>(c - '0');
+        }
+        return true;
     }
 
     void read() {
+        if (reading_ || eof_ || closed_ || upgrade_ || count_ == maxPipeline) return;
+        reading_ = true;
+        stream_.expires_after(idleTimeout_);
         auto self = shared_from_this();
-        http::async_read(socket_, buffer_, req_, [self](auto ec, auto) {
-            if (!ec) self->handle();
+        req_.clear();               // headers; the body string keeps its capacity for the next request
+        req_.body().clear();
+        http::async_read(stream_, buffer_, req_, [self](auto ec, auto) {
+            self->reading_ = false;
+            if (ec) {
+                // Client done, idle timeout or garbage: finish what's owed, then go.
+                self->eof_ = true;
+                self->finishIfDrained();
+                return;
+            }
+            self->handle();
         });
     }
 
+    void submit(Slot& slot, EngineCommand cmd) {
+        metrics::record(metrics::Parse, metrics::now() - slot.readAt);
+        slot.kind = cmd.kind;
+        slot.id = cmd.id;
+        slot.owner = shared_from_this();
+        cmd.client = &slot;
+        engine_.submit(ioThread, cmd);
+    }
+
     void handle() {
-        // Keep response alive for async_write
-        auto res = std::make_shared<http::response<http::string_body>>(http::status::ok, req_.version());
-        res->set(http::field::server, "beast-orderbook");
+        std::uint64_t readAt = metrics::now();
+        auto path = pathOf(req_.target());
+        Symbol symbol;
+        bool symbolOk = (req_.method() == http::verb::post && (path == "/orders" || path == "/orders/batch")) || querySymbol(symbol);
+        if (symbolOk && path == "/stream" && boost::beast::websocket::is_upgrade(req_)) {
+            upgrade_ = symbol;
+            finishIfDrained();
+            return;
+        }
+
+        Slot& slot = slots_[(head_ + count_++) % maxPipeline];
+        slot.readAt = readAt;
+        slot.ready = false;
+        slot.res.clear();           // same for responses: only the headers go
+        slot.res.body().clear();
+        slot.res.result(http::status::ok);
+        slot.res.version(req_.version());
+        slot.res.set(http::field::server, "beast-orderbook");
+        slot.res.keep_alive(req_.keep_alive());
+        route(slot, path, symbol, symbolOk);
+        write();
+        if (req_.keep_alive()) read();
+        else eof_ = true;
+    }
+
+    // Fills in the response, or submits the command that will.
+    void route(Slot& slot, boost::beast::string_view path, const Symbol& symbol, bool symbolOk) {
+        auto& res = slot.res;
 
         // Preflight for CORS
         if (req_.method() == http::verb::options) {
-            res->result(http::status::no_content);
-            addCors(*res);
-            res->prepare_payload();
-        } else if (req_.method() == http::verb::get && req_.target().starts_with("/book")) {
-            addCors(*res);
-            res->set(http::field::content_type, "application/json");
-            std::size_t depth = 10;
-            auto snap = ob_.snapshot(depth);
-            std::ostringstream oss;
-            oss << "{\"bids\":[";
-            for (std::size_t i=0; i<snap.bids.size(); ++i) {
-                if (i) oss << ',';
-                oss << "{\"price\":" << snap.bids[i].price << ",\"qty\":" << snap.bids[i].qty << "}";
+            res.result(http::status::no_content);
+            addCors(res);
+        } else if (!symbolOk) {
+            addCors(res);
+            fail(res, http::status::bad_request, "bad symbol");
+        } else if (req_.method() == http::verb::get && path == "/book") {
+            std::size_t depth = 0;
+            if (!queryDepth(depth)) {
+                addCors(res);
+                fail(res, http::status::bad_request, "bad depth");
+            } else if (!cachedBook(slot, symbol, depth)) {
+                slot.symbol = symbol;
+                slot.depth = depth;
+                return submit(slot, EngineCommand{EngineCommand::Kind::Book, Side::Buy, false, 0, 0.0, 0, depth, symbol, nullptr});
             }
-            oss << "],\"asks\":[";
-            for (std::size_t i=0; i<snap.asks.size(); ++i) {
-                if (i) oss << ',';
-                oss << "{\"price\":" << snap.asks[i].price << ",\"qty\":" << snap.asks[i].qty << "}";
+        } else if (req_.method() == http::verb::get && path == "/candles") {
+            std::int64_t interval = 0;
+            std::size_t n = 0;
+            if (queryCandles(interval, n)) {
+                return submit(slot, EngineCommand{EngineCommand::Kind::Candles, Side::Buy, false, 0, 0.0, static_cast<OrderId>(interval), n,
+                                                  symbol, nullptr});
             }
-            oss << "]}";
-            res->body() = oss.str();
-            res->prepare_payload();
-        } else if (req_.method() == http::verb::get && (req_.target() == "/" || req_.target() == "/index.html")) {
-            addCors(*res);
-            res->set(http::field::content_type, "text/html");
-            std::ifstream file("web/index.html"); // path relative to repo root / working dir
-            if (file) {
-                std::ostringstream html;
-                html << file.rdbuf();
-                res->body() = html.str();
+            addCors(res);
+            fail(res, http::status::bad_request, "bad interval or n");
+        } else if (const StaticAssets::Asset* asset =
+                       req_.method() == http::verb::get ? assets_.find(std::string_view(path.data(), path.size())) : nullptr) {
+            addCors(res);
+            serveAsset(res, *asset);
+        } else if (req_.method() == http::verb::get && path == "/") {
+            addCors(res);
+            res.set(http::field::content_type, "text/html");
+            res.body() = "<html><body><p>Orderbook API: try <a href=\"/book\">/book</a></p></body></html>";
+        } else if (req_.method() == http::verb::get && path == "/metrics") {
+            res.set(http::field::content_type, "text/plain; version=0.0.4");
+            res.body() = metrics::render();
+        } else if (req_.method() == http::verb::get && path == "/favicon.ico") {
+            res.result(http::status::no_content);
+        } else if (req_.method() == http::verb::post && path == "/orders") {
+            addCors(res);
+            json::OrderFields order;
+            Symbol orderSymbol;
+            const char* error = json::parseOrder(req_.body(), order);
+            if (!error && !bodySymbol(order.symbol, orderSymbol)) error = "bad symbol";
+            if (!error) error = json::incomplete(order);
+            if (error) {
+                fail(res, http::status::bad_request, error);
+            } else if (*order.type == OrderType::Stop || *order.type == OrderType::StopLimit) {
+                bool limit = *order.type == OrderType::StopLimit;
+                EngineCommand cmd{EngineCommand::Kind::Stop, *order.side, limit, *order.qty, limit ? *order.price : 0.0,
+                                  0, 0, orderSymbol, nullptr};
+                cmd.stopPrice = *order.stopPrice;
+                return submit(slot, cmd);
+            } else if (*order.type == OrderType::Market) {
+                return submit(slot, EngineCommand{EngineCommand::Kind::Market, *order.side, false, *order.qty, 0.0, 0, 0, orderSymbol, nullptr});
             } else {
-                res->body() = "<html><body><p>Orderbook API: try <a href=\"/book\">/book</a></p></body></html>";
+                return submit(slot, EngineCommand{EngineCommand::Kind::Limit, *order.side, true, *order.qty, *order.price, 0, 0, orderSymbol, nullptr});
             }
-            res->prepare_payload();
-        } else if (req_.method() == http::verb::get && req_.target() == "/favicon.ico") {
-            res->result(http::status::no_content);
-            res->prepare_payload();
-        } else if (req_.method() == http::verb::post && req_.target() == "/orders") {
-            addCors(*res);
-            std::string sideStr;
-            std::string typeStr;
-            double price = 0.0;
-            double qtyNum = 0.0;
-
-            bool sideOk = extractString(req_.body(), "side", sideStr);
-            bool typeOk = extractString(req_.body(), "type", typeStr);
-            bool qtyOk = extractNumber(req_.body(), "qty", qtyNum);
-
-            if (!sideOk || !typeOk || !qtyOk) {
-                res->result(http::status::bad_request);
-                res->body() = "{\"error\":\"missing side/type/qty\"}";
-                res->prepare_payload();
-            } else {
-                Side side = (sideStr == "buy" || sideStr == "Buy") ? Side::Buy : Side::Sell;
-                bool isLimit = (typeStr == "limit" || typeStr == "Limit");
-                ExecutionResults exec{};
-                auto start = std::chrono::high_resolution_clock::now();
-                if (isLimit) {
-                    bool priceOk = extractNumber(req_.body(), "price", price);
-                    if (!priceOk) {
-                        res->result(http::status::bad_request);
-                        res->body() = "{\"error\":\"missing price for limit order\"}";
-                        res->prepare_payload();
-                    } else {
-                        exec = ob_.addLimitOrder(price, static_cast<int>(qtyNum), side);
-                        auto end = std::chrono::high_resolution_clock::now();
-                        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
-                        res->set(http::field::content_type, "application/json");
-                        double avg = exec.filled > 0 ? exec.notional / static_cast<double>(exec.filled) : 0.0;
-                        std::ostringstream body;
-                        body << "{\"status\":\"ok\",\"filled\":" << exec.filled
-                             << ",\"requested\":" << exec.requested
-                             << ",\"trades\":" << exec.trades
-                             << ",\"avg_price\":" << avg
-                             << ",\"latency_ns\":" << ns << "}";
-                        res->body() = body.str();
-                        res->prepare_payload();
-                    }
-                } else {
-                    exec = ob_.addMarketOrder(static_cast<int>(qtyNum), side);
-                    auto end = std::chrono::high_resolution_clock::now();
-                    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
-                    res->set(http::field::content_type, "application/json");
-                    double avg = exec.filled > 0 ? exec.notional / static_cast<double>(exec.filled) : 0.0;
-                    std::ostringstream body;
-                    body << "{\"status\":\"ok\",\"filled\":" << exec.filled
-                         << ",\"requested\":" << exec.requested
-                         << ",\"trades\":" << exec.trades
-                         << ",\"avg_price\":" << avg
-                         << ",\"latency_ns\":" << ns << "}";
-                    res->body() = body.str();
-                    res->prepare_payload();
-                }
+        } else if (req_.method() == http::verb::post && path == "/orders/batch") {
+            addCors(res);
+            std::string_view batchSymbol;
+            std::size_t at = json::noOrder;
+            Symbol orderSymbol;
+            const char* error = json::parseBatch(req_.body(), batchSymbol, slot.orders, maxBatchOrders, at);
+            if (!error && !bodySymbol(batchSymbol, orderSymbol)) error = "bad symbol";
+            if (!error) return submit(slot, EngineCommand{EngineCommand::Kind::Batch, Side::Buy, false, 0, 0.0, 0, 0, orderSymbol, nullptr});
+            fail(res, http::status::bad_request, error);
+            if (at != json::noOrder) { // say which order: {"error":"bad qty","order":17}
+                res.body().pop_back();
+                json::Writer(res.body()) << ",\"order\":" << at << '}';
             }
-        } else if (req_.method() == http::verb::post && req_.target() == "/stimmy") {
-            addCors(*res);
-            static thread_local std::mt19937 rng(std::random_device{}());
-            std::uniform_real_distribution<double> priceDist(95.0, 125.0);
-            std::uniform_int_distribution<int> qtyDist(1, 25);
-            for (int i = 0; i < 20; ++i) {
-                ob_.addLimitOrder(priceDist(rng), qtyDist(rng), Side::Buy);
-                ob_.addLimitOrder(priceDist(rng), qtyDist(rng), Side::Sell);
+        } else if ((req_.method() == http::verb::delete_ || req_.method() == http::verb::patch) && path.starts_with("/orders/")) {
+            addCors(res);
+            OrderId id = 0;
+            json::OrderFields order;
+            const char* error = nullptr;
+            if (!extractOrderId(req_.target(), id)) {
+                fail(res, http::status::bad_request, "bad order id");
+            } else if (req_.method() == http::verb::delete_) {
+                return submit(slot, EngineCommand{EngineCommand::Kind::Cancel, Side::Buy, false, 0, 0.0, id, 0, symbol, nullptr});
+            } else if ((error = json::parseOrder(req_.body(), order)) || !order.qty) {
+                fail(res, http::status::bad_request, error ? error : "missing qty");
+            } else {
+                return submit(slot, EngineCommand{EngineCommand::Kind::Modify, Side::Buy, order.price.has_value(), *order.qty,
+                                                  order.price.value_or(0.0), id, 0, symbol, nullptr});
             }
-            res->set(http::field::content_type, "application/json");
-            res->body() = "{\"status\":\"ok\",\"added\":40}";
-            res->prepare_payload();
-        } else if (req_.method() == http::verb::post && req_.target() == "/clear") {
-            addCors(*res);
-            ob_ = orderbook{};
-            res->set(http::field::content_type, "application/json");
-            res->body() = "{\"status\":\"cleared\"}";
-            res->prepare_payload();
+        } else if (req_.method() == http::verb::post && path == "/stimmy") {
+            return submit(slot, EngineCommand{EngineCommand::Kind::Stimmy, Side::Buy, false, 0, 0.0, 0, 0, symbol, nullptr});
+        } else if (req_.method() == http::verb::post && path == "/clear") {
+            return submit(slot, EngineCommand{EngineCommand::Kind::Clear, Side::Buy, false, 0, 0.0, 0, 0, symbol, nullptr});
+        } else {
+            addCors(res);
+            fail(res, http::status::not_found, "not found");
+        }
+        res.prepare_payload();
+        slot.ready = true;
+    }
+
+    // Answers /book without going to the engine when the client already has the current
+    // version (304) or the cache does. False if it has to be snapshotted.
+    bool cachedBook(Slot& slot, const Symbol& symbol, std::size_t depth) {
+        auto& res = slot.res;
+        std::uint64_t version = engine_.bookVersion(symbol);
+        char tag[BookCache::etagSize];
+        auto etag = cache_.etag(version, tag);
+        if (etagMatches(header(http::field::if_none_match), etag)) {
+            res.result(http::status::not_modified);
+        } else if (cache_.find(symbol, depth, version, res.body())) {
+            res.set(http::field::content_type, "application/json");
         } else {
-            res->result(http::status::not_found);
-            addCors(*res);
-            res->set(http::field::content_type, "application/json");
-            res->body() = "{\"error\":\"not found\"}";
-            res->prepare_payload();
+            return false;
+        }
+        addCors(res);
+        res.set(http::field::etag, boost::beast::string_view(etag.data(), etag.size()));
+        res.set(http::field::cache_control, "no-cache");
+        return true;
+    }
+
+    // The gzip copy if there is one and the client takes it; each encoding has its own tag.
+    void serveAsset(http::response<http::string_body>& res, const StaticAssets::Asset& asset) {
+        bool gzip = !asset.gzipped.empty() && acceptsGzip(header(http::field::accept_encoding));
+        const std::string& etag = gzip ? asset.gzipEtag : asset.etag;
+        res.set(http::field::etag, etag);
+        res.set(http::field::cache_control, "no-cache");
+        if (!asset.gzipped.empty()) res.set(http::field::vary, "Accept-Encoding");
+        if (etagMatches(header(http::field::if_none_match), etag)) {
+            res.result(http::status::not_modified);
+            return;
         }
+        res.set(http::field::content_type, asset.contentType);
+        if (gzip) res.set(http::field::content_encoding, "gzip");
+        res.body().assign(gzip ? asset.gzipped : asset.body);
+    }
 
+    // Back on the strand with the engine's reply for one slot.
+    void respond(Slot& slot) {
+        if (closed_) return;
+        std::uint64_t serializeAt = metrics::now();
+        const EngineReply& reply = slot.reply;
+        auto& res = slot.res;
+        addCors(res);
+        res.set(http::field::content_type, "application/json");
+        switch (slot.kind) {
+            case EngineCommand::Kind::Book: {
+                json::book(res.body(), reply.book, reply.spread, reply.bookSeq);
+                cache_.store(slot.symbol, slot.depth, reply.bookVersion, res.body());
+                char tag[BookCache::etagSize];
+                auto etag = cache_.etag(reply.bookVersion, tag);
+                res.set(http::field::etag, boost::beast::string_view(etag.data(), etag.size()));
+                res.set(http::field::cache_control, "no-cache");
+                break;
+            }
+            case EngineCommand::Kind::Cancel:
+                if (reply.found) json::Writer(res.body()) << "{\"status\":\"cancelled\",\"id\":" << slot.id << '}';
+                else fail(res, http::status::not_found, "unknown order");
+                break;
+            case EngineCommand::Kind::Stimmy:
+                res.body() = "{\"status\":\"ok\",\"added\":40}";
+                break;
+            case EngineCommand::Kind::Clear:
+                res.body() = "{\"status\":\"cleared\"}";
+                break;
+            case EngineCommand::Kind::Batch:
+                json::batch(res.body(), reply.results, reply.matchNs);
+                break;
+            case EngineCommand::Kind::Candles:
+                json::candles(res.body(), static_cast<std::int64_t>(slot.id), reply.candles);
+                break;
+            case EngineCommand::Kind::Limit:
+            case EngineCommand::Kind::Market:
+            case EngineCommand::Kind::Modify:
+            case EngineCommand::Kind::Stop:
+                if (!reply.found) fail(res, http::status::not_found, "unknown order");
+                else if (reply.exec.rejected) fail(res, http::status::bad_request, "price too far from the book");
+                else json::execution(res.body(), reply.exec, slot.kind != EngineCommand::Kind::Market, reply.matchNs);
+                break;
+        }
+        res.prepare_payload();
+        metrics::record(metrics::Serialize, metrics::now() - serializeAt);
+        slot.ready = true;
+        write();
+    }
+
+    // Writes the oldest response once it's ready; the next one goes when this one is done.
+    void write() {
+        if (writing_ || closed_ || count_ == 0 || !slots_[head_].ready) return;
+        writing_ = true;
+        Slot& slot = slots_[head_];
+        std::uint64_t writeAt = metrics::now();
+        stream_.expires_after(idleTimeout_);
         auto self = shared_from_this();
-        http::async_write(socket_, *res, [self, res](auto ec, auto) {
-            self->socket_.shutdown(tcp::socket::shutdown_send, ec);
+        http::async_write(stream_, slot.res, [self, &slot, writeAt](auto ec, auto) {
+            if constexpr (metrics::enabled) {
+                std::uint64_t done = metrics::now();
+                metrics::record(metrics::Write, done - writeAt);
+                metrics::record(metrics::Request, done - slot.readAt);
+                metrics::count(metrics::HttpRequests);
+            }
+            self->writing_ = false;
+            self->head_ = (self->head_ + 1) % maxPipeline;
+            --self->count_;
+            if (ec) return self->close();
+            if (!slot.res.keep_alive()) self->eof_ = true;
+            slot.res.body().clear();
+            if (slot.orders.capacity() > 1024) { // don't sit on a big batch's buffers between requests
+                slot.orders = {};
+                slot.reply.results = {};
+                slot.res.body() = std::string();
+            }
+            self->write();
+            self->read();
+            self->finishIfDrained();
         });
     }
+
+    // Every response written: hand over a pending /stream upgrade, or hang up if no more
+    // requests are coming.
+    void finishIfDrained() {
+        if (closed_ || count_ != 0 || writing_) return;
+        if (upgrade_) {
+            closed_ = true;
+            hub_.accept(stream_.release_socket(), std::move(req_), *upgrade_);
+        } else if (eof_) {
+            closed_ = true;
+            boost::system::error_code ec;
+            stream_.socket().shutdown(tcp::socket::shutdown_send, ec);
+        }
+    }
+
+    // Replies still owed by the engine arrive later and are dropped.
+    void close() {
+        if (closed_) return;
+        closed_ = true;
+        boost::system::error_code ec;
+        stream_.socket().close(ec);
+    }
 };
 
 class Listener : public std::enable_shared_from_this<Listener> {
 public:
-    Listener(boost::asio::io_context& ioc, tcp::endpoint ep, orderbook& ob)
-        : ioc_(ioc), acceptor_(ioc), ob_(ob) {
+    Listener(boost::asio::io_context& ioc, tcp::endpoint ep, Sequencer& engine, StreamHub& hub, BookCache& cache,
+             const StaticAssets& assets, int maxConnections, std::chrono::seconds idleTimeout)
+        : ioc_(ioc), acceptor_(ioc), engine_(engine), hub_(hub), cache_(cache), assets_(assets), maxConnections_(maxConnections),
+          idleTimeout_(idleTimeout) {
         acceptor_.open(ep.protocol());
         acceptor_.set_option(boost::asio::socket_base::reuse_address(true));
         acceptor_.bind(ep);
@@ -213,28 +524,154 @@ public:
 private:
     boost::asio::io_context& ioc_;
     tcp::acceptor acceptor_;
-    orderbook& ob_;
+    Sequencer& engine_;
+    StreamHub& hub_;
+    BookCache& cache_;
+    const StaticAssets& assets_;
+    int maxConnections_;
+    std::chrono::seconds idleTimeout_;
     void accept() {
-        acceptor_.async_accept([self=shared_from_this()](auto ec, auto socket) {
-            if (!ec) std::make_shared<BookHandler>(std::move(socket), self->ob_)->run();
+        // Strand per connection: engine replies come back while a read may be pending, and a
+        // /stream upgrade keeps the socket and has concurrent handlers.
+        acceptor_.async_accept(boost::asio::make_strand(ioc_), [self=shared_from_this()](auto ec, auto socket) {
+            if (!ec) {
+                auto handler = std::make_shared<BookHandler>(std::move(socket), self->engine_, self->hub_, self->cache_, self->assets_,
+                                                             self->idleTimeout_);
+                if (BookHandler::open() > self->maxConnections_) handler->refuse();
+                else handler->run();
+            }
             self->accept();
         });
     }
 };
 
+static int envInt(const char* name, int fallback) {
+    if (const char* env = std::getenv(name)) return std::atoi(env);
+    return fallback;
+}
+
 int main() {
     try {
-        orderbook ob;
-        boost::asio::io_context ioc{1};
+        // Books are created per symbol on first use; keep each one's up-front reservation modest.
+        BookConfig config;
+        config.ladderTicks = 8192;
+        config.reserveOrders = 1 << 14;
+
+        // IO_THREADS parse/serialise HTTP. SHARDS matching threads each own the books for
+        // their slice of the symbols (pinned from ENGINE_CPU upwards if set).
+        int hw = static_cast<int>(std::thread::hardware_concurrency());
+        int ioThreads = std::max(1, envInt("IO_THREADS", hw > 1 ? hw - 1 : 1));
+        int shards = std::max(1, envInt("SHARDS", 1));
+        boost::asio::io_context ioc{ioThreads};
+        Sequencer engine(config, static_cast<std::size_t>(shards), static_cast<std::size_t>(ioThreads), envInt("ENGINE_CPU", -1));
+        StreamHub hub(ioc, engine);
+        BookCache bookCache;
+
+        // The UI is read (and gzipped) once here; WEB_DIR overrides where from.
+        const char* webEnv = std::getenv("WEB_DIR");
+        std::string webDir = webEnv ? webEnv : "web"; // relative to the working dir, i.e. the repo root
+        StaticAssets assets;
+        assets.load(webDir);
+        std::cout << "Loaded " << assets.files() << " static files from " << webDir << std::endl;
+
+        // Rebuild the books before taking traffic: restore the last snapshot, then replay the
+        // journal past the point it covers. JOURNAL names the journal (empty turns journalling
+        // and snapshots off); JOURNAL_FSYNC is "batch" (default), "none" or a sync interval in
+        // ms. SNAPSHOT names the snapshot file (empty: none), written every SNAPSHOT_INTERVAL s.
+        std::unique_ptr<Journal> journal;
+        std::unique_ptr<Snapshotter> snapshotter;
+        const char* journalEnv = std::getenv("JOURNAL");
+        std::string journalPath = journalEnv ? journalEnv : "orderbook.journal";
+        const char* snapshotEnv = std::getenv("SNAPSHOT");
+        std::string snapshotPath = snapshotEnv ? snapshotEnv : "orderbook.snapshot";
+        if (!journalPath.empty()) {
+            std::size_t from = 0;
+            bool seeded = false;
+            if (!snapshotPath.empty()) {
+                auto start = std::chrono::steady_clock::now();
+                SnapshotFile snapshot;
+                std::error_code ec;
+                auto journalBytes = std::filesystem::file_size(journalPath, ec);
+                if (snapshot.open(snapshotPath)) {
+                    if (ec || snapshot.journalOffset() > journalBytes) {
+                        std::cerr << "Ignoring " << snapshotPath << ": it is ahead of " << journalPath << '\n';
+                    } else {
+                        for (const auto& book : snapshot.books()) {
+                            if (!engine.restoreBook(book.symbol, book.data, book.size)) {
+                                throw std::runtime_error("bad book image for " + std::string(book.symbol.view()) + " in " + snapshotPath);
+                            }
+                        }
+                        from = snapshot.journalOffset();
+                        seeded = true;
+                        std::cout << "Restored " << snapshot.books().size() << " books from " << snapshotPath << " in "
+                                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+                                  << " ms" << std::endl;
+                    }
+                }
+            }
+            auto stats = Journal::replay(journalPath, [&engine](const JournalRecord& r) { engine.apply(replayCommand(r)); }, from);
+            if (stats.records) {
+                std::cout << "Replayed " << stats.records << " journal records in " << stats.seconds * 1e3 << " ms ("
+                          << static_cast<long long>(stats.records / std::max(stats.seconds, 1e-9)) << "/s)" << std::endl;
+            }
+            JournalConfig journalConfig;
+            journalConfig.path = journalPath;
+            std::string fsync = std::getenv("JOURNAL_FSYNC") ? std::getenv("JOURNAL_FSYNC") : "batch";
+            if (fsync == "none") {
+                journalConfig.fsync = FsyncPolicy::Never;
+            } else if (fsync != "batch") {
+                journalConfig.fsync = FsyncPolicy::Interval;
+                journalConfig.fsyncInterval = std::chrono::milliseconds(std::max(1, std::atoi(fsync.c_str())));
+            }
+            journal = std::make_unique<Journal>(journalConfig, engine.shardCount(), std::max(stats.validBytes, from));
+            journal->start();
+            engine.setJournal(journal.get());
+
+            if (!snapshotPath.empty()) {
+                snapshotter = std::make_unique<Snapshotter>(config, journalPath, snapshotPath,
+                                                            std::chrono::seconds(std::max(1, envInt("SNAPSHOT_INTERVAL", 60))));
+                snapshotter->start(seeded);
+            }
+        }
+
+        engine.setFeed(&hub);
+        engine.start();
+
         // Render provides the port via the PORT env var; default to 9000 for local dev.
         unsigned short port = 9000;
         if (const char* env = std::getenv("PORT")) {
             int p = std::atoi(env);
             if (p > 0 && p < 65536) port = static_cast<unsigned short>(p);
         }
-        auto listener = std::make_shared<Listener>(ioc, tcp::endpoint{tcp::v4(), port}, ob);
+        // At most HTTP_MAX_CONNECTIONS open at once (more get a 503); a connection with nothing
+        // to do for HTTP_IDLE_TIMEOUT seconds is closed.
+        int maxConnections = std::max(1, envInt("HTTP_MAX_CONNECTIONS", 1000));
+        std::chrono::seconds idleTimeout(std::max(1, envInt("HTTP_IDLE_TIMEOUT", 30)));
+        auto listener = std::make_shared<Listener>(ioc, tcp::endpoint{tcp::v4(), port}, engine, hub, bookCache, assets, maxConnections,
+                                                   idleTimeout);
         listener->run();
+
+        // Binary order entry on BINARY_PORT (default 9001, 0 turns it off).
+        int binaryPort = envInt("BINARY_PORT", 9001);
+        if (binaryPort > 0 && binaryPort < 65536) {
+            startBinaryGateway(ioc, tcp::endpoint{tcp::v4(), static_cast<unsigned short>(binaryPort)}, engine);
+        }
+
+        boost::asio::signal_set signals(ioc, SIGINT, SIGTERM);
+        signals.async_wait([&ioc](auto, auto) { ioc.stop(); });
+
+        std::vector<std::thread> pool;
+        for (int i = 1; i < ioThreads; ++i) {
+            pool.emplace_back([&ioc, i] {
+                ioThread = static_cast<std::size_t>(i);
+                ioc.run();
+            });
+        }
         ioc.run();
+        for (auto& t : pool) t.join();
+        engine.stop();
+        if (journal) journal->stop(); // flush what the shards appended last
+        if (snapshotter) snapshotter->stop(); // and snapshot it, so the next start replays nothing
         return 0;
     } catch (const std::exception& e) {
         std::cerr << "Server error: " << e.what() << '\n';
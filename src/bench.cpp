@@ -0,0 +1,1027 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "orderbook.h"
+#include "latency_histogram.h"
+#include "sequencer.h"
+#include "fill_listener.h"
+#include "alloc_counter.h"
+#include "json.h"
+
+using std::cout;
+using std::string;
+using std::vector;
+
+// Seeded, reproducible order flow through the engine. Each run reports throughput from an
+// untimed-per-order pass and a latency histogram from a second pass that stamps every call.
+// Results can go to CSV and be diffed against an older CSV to catch regressions.
+// With --shards it instead drives the sharded multi-symbol Sequencer and reports how
+// aggregate throughput scales with the number of matching threads. --restore compares
+// rebuilding a deep book by replaying its flow against loading an orderbook::save() image.
+// --fills prices per-fill reporting: the same flow through a book with no fill listener and
+// one whose RingFillListener queues every fill, drained after each command.
+// --json prices the HTTP layer's body handling: parsing /orders bodies and encoding the
+// /orders and /book replies, json.h against the string-search + ostringstream code it replaced.
+// --batch runs the same limits and markets one call at a time and through submitBatch.
+// --stops prices the stop trigger check with 100k stops waiting; --candles prices feeding
+// every trade into the OHLCV bars. --fixed runs the same flow through FixedPointBook.
+
+namespace {
+
+enum class CmdKind : std::uint8_t { Limit, Market, Cancel };
+
+struct Command {
+    CmdKind kind;
+    Side side;
+    int qty;
+    double price;
+    OrderId id;
+};
+
+enum class Workload { Mix, Deep, Cancel, Sweep };
+
+const char* workloadName(Workload w) {
+    switch (w) {
+        case Workload::Mix: return "mix";
+        case Workload::Deep: return "deep";
+        case Workload::Cancel: return "cancel";
+        case Workload::Sweep: return "sweep";
+    }
+    return "?";
+}
+
+// splitmix64 so a seed gives the same stream on every compiler/standard library.
+class Rng {
+public:
+    explicit Rng(std::uint64_t seed) : state_(seed) {}
+    std::uint64_t next() {
+        std::uint64_t z = (state_ += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    int uniform(int lo, int hi) { return lo + static_cast<int>(next() % static_cast<std::uint64_t>(hi - lo + 1)); }
+    double unit() { return static_cast<double>(next() >> 11) * 0x1.0p-53; }
+    bool chance(int percent) { return uniform(0, 99) < percent; }
+private:
+    std::uint64_t state_;
+};
+
+class FlowGenerator {
+public:
+    FlowGenerator(Workload w, std::uint64_t seed) : w_(w), rng_(seed) {}
+
+    Command next() {
+        Side side = rng_.chance(50) ? Side::Buy : Side::Sell;
+        switch (w_) {
+            case Workload::Mix: // the CLI stimmy: 75% limit anywhere in 95-125, 25% market
+                if (rng_.chance(25)) return market(side, rng_.uniform(1, 25));
+                return limit(side, 95.0 + rng_.unit() * 30.0, rng_.uniform(1, 25));
+            case Workload::Deep: { // passive limits piling up away from a 110 mid
+                if (rng_.chance(5)) return market(side, rng_.uniform(1, 25));
+                double off = 0.01 + rng_.unit() * rng_.unit() * 20.0;
+                return limit(side, side == Side::Buy ? 110.0 - off : 110.0 + off, rng_.uniform(1, 25));
+            }
+            case Workload::Cancel: // cancel/replace churn near the touch
+                if (limits_ > 0 && rng_.chance(50)) {
+                    std::uint64_t back = rng_.next() % std::min<std::uint64_t>(limits_, 1000);
+                    return Command{CmdKind::Cancel, side, 0, 0.0, limits_ - back};
+                }
+                if (rng_.chance(10)) return market(side, rng_.uniform(1, 10));
+                return limit(side, (side == Side::Buy ? 109.0 : 111.0) + (rng_.unit() - 0.5) * 4.0, rng_.uniform(1, 25));
+            case Workload::Sweep: // many small makers, big market orders walking several levels
+                if (rng_.chance(15)) return market(side, rng_.uniform(100, 400));
+                return limit(side, (side == Side::Buy ? 108.0 : 112.0) + (rng_.unit() - 0.5) * 6.0, rng_.uniform(1, 5));
+        }
+        return market(side, 1);
+    }
+
+private:
+    Command limit(Side side, double price, int qty) {
+        ++limits_; // the engine hands out ids 1, 2, 3... in submission order
+        return Command{CmdKind::Limit, side, qty, price, 0};
+    }
+    Command market(Side side, int qty) { return Command{CmdKind::Market, side, qty, 0.0, 0}; }
+
+    Workload w_;
+    Rng rng_;
+    std::uint64_t limits_{0};
+};
+
+template <typename Book>
+inline int execute(Book& ob, const Command& c) {
+    switch (c.kind) {
+        case CmdKind::Limit: return ob.addLimitOrder(c.price, c.qty, c.side).filled;
+        case CmdKind::Market: return ob.addMarketOrder(c.qty, c.side).filled;
+        case CmdKind::Cancel: return ob.cancel(c.id) ? 1 : 0;
+    }
+    return 0;
+}
+
+struct Options {
+    vector<std::size_t> sizes{1000, 10000, 100000, 1000000, 10000000};
+    vector<Workload> workloads{Workload::Mix, Workload::Deep, Workload::Cancel, Workload::Sweep};
+    std::uint64_t seed{42};
+    std::size_t reserve{1u << 20};
+    string csvPath;
+    string baselinePath;
+    double threshold{10.0};
+    vector<std::size_t> shards;       // non-empty: sharded scaling mode
+    std::size_t symbols{256};
+    std::size_t producers{1};
+    std::size_t shardOrders{2000000};
+    bool restore{false};              // startup-cost mode
+    bool fills{false};                // fill listener overhead mode
+    bool json{false};                 // request/response JSON mode
+    bool batch{false};                // submitBatch vs single orders mode
+    bool stops{false};                // stop trigger overhead mode
+    bool candles{false};              // candle aggregation overhead mode
+    bool fixed{false};                // double vs FixedPointBook mode
+    bool sizesGiven{false};
+};
+
+struct Result {
+    Workload workload;
+    std::size_t orders;
+    double nsPerOrder;
+    double ordersPerSec;
+    std::uint64_t p50, p99, p999, max;
+    std::size_t allocs;
+};
+
+constexpr std::size_t chunkSize = 1 << 16;
+volatile long long sink = 0;
+
+orderbook makeBook(const Options& opt) {
+    BookConfig config;
+    config.ladderTicks = 8192;
+    config.reserveOrders = opt.reserve;
+    return orderbook{config};
+}
+
+// Commands are generated a chunk at a time outside the timed region so RNG cost and a
+// 10M-entry command buffer both stay out of the numbers.
+Result run(Workload w, std::size_t n, const Options& opt) {
+    using clock = std::chrono::steady_clock;
+    Result r{w, n, 0, 0, 0, 0, 0, 0, 0};
+    vector<Command> chunk(std::min(n, chunkSize));
+
+    {
+        orderbook ob = makeBook(opt);
+        FlowGenerator gen(w, opt.seed);
+        long long ns = 0;
+        long long filled = 0;
+        for (std::size_t done = 0; done < n;) {
+            std::size_t m = std::min(chunkSize, n - done);
+            for (std::size_t i = 0; i < m; ++i) chunk[i] = gen.next();
+            std::size_t allocs = heapAllocations();
+            auto start = clock::now();
+            for (std::size_t i = 0; i < m; ++i) filled += execute(ob, chunk[i]);
+            auto end = clock::now();
+            r.allocs += heapAllocations() - allocs;
+            ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            done += m;
+        }
+        sink = sink + filled;
+        r.nsPerOrder = static_cast<double>(ns) / static_cast<double>(n);
+        r.ordersPerSec = ns > 0 ? 1e9 * static_cast<double>(n) / static_cast<double>(ns) : 0.0;
+    }
+
+    {
+        orderbook ob = makeBook(opt);
+        FlowGenerator gen(w, opt.seed);
+        LatencyHistogram hist;
+        long long filled = 0;
+        for (std::size_t done = 0; done < n;) {
+            std::size_t m = std::min(chunkSize, n - done);
+            for (std::size_t i = 0; i < m; ++i) chunk[i] = gen.next();
+            for (std::size_t i = 0; i < m; ++i) {
+                auto start = clock::now();
+                filled += execute(ob, chunk[i]);
+                auto end = clock::now();
+                hist.record(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+            }
+            done += m;
+        }
+        sink = sink + filled;
+        r.p50 = hist.percentile(0.50);
+        r.p99 = hist.percentile(0.99);
+        r.p999 = hist.percentile(0.999);
+        r.max = hist.max();
+    }
+    return r;
+}
+
+// Mix flow spread uniformly over `symbols` books, pushed through a Sequencer with each
+// shard count in turn. Books are created before the clock starts; the clock stops when
+// every shard has executed its last command.
+void runSharded(const Options& opt) {
+    using clock = std::chrono::steady_clock;
+    BookConfig config;
+    config.ladderTicks = 4096;
+    config.reserveOrders = 1024;
+
+    vector<Symbol> symbols(opt.symbols);
+    for (std::size_t i = 0; i < symbols.size(); ++i) Symbol::parse("S" + std::to_string(i), symbols[i]);
+
+    std::size_t perProducer = opt.shardOrders / opt.producers;
+    vector<vector<EngineCommand>> flows(opt.producers);
+    for (std::size_t p = 0; p < opt.producers; ++p) {
+        FlowGenerator gen(Workload::Mix, opt.seed + p);
+        Rng pick(opt.seed * 31 + p);
+        flows[p].reserve(perProducer);
+        for (std::size_t i = 0; i < perProducer; ++i) {
+            Command c = gen.next();
+            auto kind = c.kind == CmdKind::Limit ? EngineCommand::Kind::Limit : EngineCommand::Kind::Market;
+            flows[p].push_back(EngineCommand{kind, c.side, false, c.qty, c.price, 0, 0, symbols[pick.next() % symbols.size()], nullptr});
+        }
+    }
+
+    cout << opt.symbols << " symbols, " << opt.producers << " producer thread(s), " << perProducer * opt.producers
+         << " orders, " << std::thread::hardware_concurrency() << " hardware threads\n";
+    cout << std::setw(7) << "shards" << std::setw(14) << "orders/s" << std::setw(10) << "ns/order" << std::setw(9) << "speedup" << '\n';
+    cout << std::fixed;
+
+    double first = 0.0;
+    for (std::size_t shards : opt.shards) {
+        Sequencer engine(config, shards, opt.producers);
+        engine.start();
+        for (const auto& sym : symbols) engine.submit(0, EngineCommand{EngineCommand::Kind::Market, Side::Buy, false, 0, 0.0, 0, 0, sym, nullptr});
+        while (engine.processed() < symbols.size()) std::this_thread::yield();
+
+        std::uint64_t target = symbols.size() + perProducer * opt.producers;
+        auto start = clock::now();
+        vector<std::thread> producers;
+        for (std::size_t p = 0; p < opt.producers; ++p) {
+            producers.emplace_back([&engine, &flows, p] {
+                for (const auto& cmd : flows[p]) engine.submit(p, cmd);
+            });
+        }
+        for (auto& t : producers) t.join();
+        while (engine.processed() < target) std::this_thread::yield();
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+        engine.stop();
+
+        double n = static_cast<double>(perProducer * opt.producers);
+        double rate = 1e9 * n / static_cast<double>(ns);
+        if (first == 0.0) first = rate;
+        cout << std::setw(7) << shards << std::setw(14) << std::setprecision(0) << rate << std::setw(10) << std::setprecision(1)
+             << static_cast<double>(ns) / n << std::setw(8) << std::setprecision(2) << rate / first << "x" << std::endl;
+    }
+}
+
+// What a restart costs: the deep flow (books that mostly rest) replayed into an empty book,
+// versus saving that book and restoring the image. The restored book is checked against the
+// original level by level.
+void runRestore(const Options& opt) {
+    using clock = std::chrono::steady_clock;
+    auto ms = [](clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+    vector<std::size_t> sizes = opt.sizesGiven ? opt.sizes : vector<std::size_t>{100000, 1000000, 5000000};
+
+    cout << std::setw(10) << "commands" << std::setw(10) << "resting" << std::setw(12) << "replay ms" << std::setw(10) << "image MB"
+         << std::setw(10) << "save ms" << std::setw(12) << "restore ms" << std::setw(9) << "speedup" << '\n';
+    cout << std::fixed;
+    for (std::size_t n : sizes) {
+        FlowGenerator gen(Workload::Deep, opt.seed);
+        vector<Command> flow(n);
+        for (auto& c : flow) c = gen.next();
+
+        BookConfig config;
+        config.ladderTicks = 8192;
+        orderbook replayed(config);
+        auto start = clock::now();
+        for (const auto& c : flow) sink += execute(replayed, c);
+        double replayMs = ms(clock::now() - start);
+
+        vector<char> image;
+        start = clock::now();
+        replayed.save(image);
+        double saveMs = ms(clock::now() - start);
+
+        orderbook restored(config);
+        start = clock::now();
+        bool ok = restored.restore(image.data(), image.size());
+        double restoreMs = ms(clock::now() - start);
+
+        BookSnapshot a = replayed.snapshot(static_cast<std::size_t>(-1));
+        BookSnapshot b = restored.snapshot(static_cast<std::size_t>(-1));
+        std::size_t resting = 0;
+        for (const auto* side : {&a.bids, &a.asks}) {
+            for (const auto& level : *side) resting += static_cast<std::size_t>(level.orders);
+        }
+        auto same = [](const vector<BookLevel>& x, const vector<BookLevel>& y) {
+            if (x.size() != y.size()) return false;
+            for (std::size_t i = 0; i < x.size(); ++i) {
+                if (x[i].price != y[i].price || x[i].qty != y[i].qty || x[i].orders != y[i].orders) return false;
+            }
+            return true;
+        };
+        ok = ok && same(a.bids, b.bids) && same(a.asks, b.asks) &&
+             replayed.addLimitOrder(1.0, 1, Side::Buy).id == restored.addLimitOrder(1.0, 1, Side::Buy).id;
+
+        cout << std::setw(10) << n << std::setw(10) << resting << std::setprecision(1) << std::setw(12) << replayMs
+             << std::setw(10) << static_cast<double>(image.size()) / (1 << 20) << std::setw(10) << saveMs << std::setw(12)
+             << restoreMs << std::setw(8) << replayMs / restoreMs << "x" << (ok ? "" : "  MISMATCH") << std::endl;
+        if (!ok) std::exit(1);
+    }
+}
+
+// Whole flow generated up front, then timed once per book type. Best of 5 so a noisy
+// neighbour doesn't land on one side only.
+void runFills(const Options& opt) {
+    using clock = std::chrono::steady_clock;
+    vector<std::size_t> sizes = opt.sizesGiven ? opt.sizes : vector<std::size_t>{100000, 1000000};
+    BookConfig config;
+    config.ladderTicks = 8192;
+    config.reserveOrders = opt.reserve;
+    auto queue = std::make_unique<FillQueue>();
+
+    cout << std::left << std::setw(8) << "workload" << std::right << std::setw(10) << "orders" << std::setw(10) << "fills"
+         << std::setw(12) << "none ns/op" << std::setw(12) << "ring ns/op" << std::setw(12) << "ns/fill" << std::setw(8)
+         << "allocs" << '\n';
+    cout << std::fixed << std::setprecision(1);
+    for (Workload w : opt.workloads) {
+        for (std::size_t n : sizes) {
+            FlowGenerator gen(w, opt.seed);
+            vector<Command> flow(n);
+            for (auto& c : flow) c = gen.next();
+
+            double none = 1e300;
+            double ring = 1e300;
+            std::uint64_t fills = 0;
+            std::size_t allocs = 0;
+            for (int round = 0; round < 5; ++round) {
+                {
+                    orderbook ob(config);
+                    auto start = clock::now();
+                    for (const auto& c : flow) sink += execute(ob, c);
+                    none = std::min(none, std::chrono::duration<double, std::nano>(clock::now() - start).count());
+                }
+                {
+                    RingFillBook ob(config, RingFillListener(queue.get()));
+                    std::uint64_t seen = 0;
+                    bool inOrder = true;
+                    std::size_t before = heapAllocations();
+                    auto start = clock::now();
+                    for (const auto& c : flow) {
+                        sink += execute(ob, c);
+                        queue->consume(SIZE_MAX, [&](const Fill& f) { inOrder &= f.seq == ++seen; });
+                    }
+                    ring = std::min(ring, std::chrono::duration<double, std::nano>(clock::now() - start).count());
+                    allocs = heapAllocations() - before;
+                    fills = seen;
+                    if (!inOrder || ob.listener().dropped()) {
+                        std::cerr << "fills lost or out of order\n";
+                        std::exit(1);
+                    }
+                }
+            }
+            double perOrder = static_cast<double>(n);
+            cout << std::left << std::setw(8) << workloadName(w) << std::right << std::setw(10) << n << std::setw(10) << fills
+                 << std::setw(12) << none / perOrder << std::setw(12) << ring / perOrder << std::setw(12)
+                 << (fills ? (ring - none) / static_cast<double>(fills) : 0.0) << std::setw(8) << allocs << std::endl;
+        }
+    }
+}
+
+// The same flow through the double book and FixedPointBook, default-constructed so it
+// trades in whole cents with a tick of 1. Both snap every price to the same tick, so fills
+// have to come out identical; best of 5 each.
+void runFixed(const Options& opt) {
+    using clock = std::chrono::steady_clock;
+    vector<std::size_t> sizes = opt.sizesGiven ? opt.sizes : vector<std::size_t>{100000, 1000000};
+
+    cout << std::left << std::setw(8) << "workload" << std::right << std::setw(10) << "orders" << std::setw(12) << "filled"
+         << std::setw(14) << "double ns/op" << std::setw(13) << "fixed ns/op" << '\n';
+    cout << std::fixed << std::setprecision(1);
+    for (Workload w : opt.workloads) {
+        for (std::size_t n : sizes) {
+            FlowGenerator gen(w, opt.seed);
+            vector<Command> flow(n);
+            for (auto& c : flow) c = gen.next();
+            vector<std::int64_t> cents(n);
+            for (std::size_t i = 0; i < n; ++i) cents[i] = std::llround(flow[i].price * 100.0);
+
+            double plain = 1e300;
+            double fixed = 1e300;
+            long long plainFilled = 0;
+            long long fixedFilled = 0;
+            for (int round = 0; round < 5; ++round) {
+                {
+                    orderbook ob;
+                    ob.reserve(opt.reserve);
+                    long long filled = 0;
+                    auto start = clock::now();
+                    for (const auto& c : flow) {
+                        int r = execute(ob, c);
+                        if (c.kind == CmdKind::Cancel) sink += r;
+                        else filled += r;
+                    }
+                    plain = std::min(plain, std::chrono::duration<double, std::nano>(clock::now() - start).count());
+                    plainFilled = filled;
+                }
+                {
+                    FixedPointBook ob;
+                    ob.reserve(opt.reserve);
+                    long long filled = 0;
+                    auto start = clock::now();
+                    for (std::size_t i = 0; i < n; ++i) {
+                        const Command& c = flow[i];
+                        switch (c.kind) {
+                            case CmdKind::Limit: filled += ob.addLimitOrder(cents[i], c.qty, c.side).filled; break;
+                            case CmdKind::Market: filled += ob.addMarketOrder(c.qty, c.side).filled; break;
+                            case CmdKind::Cancel: sink += ob.cancel(c.id); break;
+                        }
+                    }
+                    fixed = std::min(fixed, std::chrono::duration<double, std::nano>(clock::now() - start).count());
+                    fixedFilled = filled;
+                }
+            }
+            if (plainFilled != fixedFilled) {
+                std::cerr << "double and fixed-point books filled differently: " << plainFilled << " vs " << fixedFilled << '\n';
+                std::exit(1);
+            }
+            double perOrder = static_cast<double>(n);
+            cout << std::left << std::setw(8) << workloadName(w) << std::right << std::setw(10) << n << std::setw(12) << plainFilled
+                 << std::setw(14) << plain / perOrder << std::setw(13) << fixed / perOrder << std::endl;
+        }
+    }
+}
+
+// A workload's limits and markets (cancels dropped: a batch doesn't carry them) one call at
+// a time (results kept, as a caller would), then through submitBatch in slices of 64, 1024
+// and 8192. Once on a book reserved up
+// front and once on a cold one (no reservation, smallest ladder) that has to grow as it goes.
+// Best of 5; the filled totals have to agree or it bails.
+void runBatch(const Options& opt) {
+    using clock = std::chrono::steady_clock;
+    vector<std::size_t> sizes = opt.sizesGiven ? opt.sizes : vector<std::size_t>{1000000};
+    constexpr std::size_t slices[] = {64, 1024, 8192};
+
+    cout << std::left << std::setw(8) << "workload" << std::setw(10) << "book" << std::right << std::setw(10) << "orders"
+         << std::setw(12) << "single" << std::setw(10) << "x64" << std::setw(10) << "x1024" << std::setw(10) << "x8192"
+         << std::setw(18) << "growths 1/x8192" << "  (ns/order)\n";
+    cout << std::fixed << std::setprecision(1);
+    for (Workload w : opt.workloads) {
+        if (w == Workload::Cancel) continue;
+        for (std::size_t n : sizes) {
+            FlowGenerator gen(w, opt.seed);
+            vector<OrderCommand> flow;
+            flow.reserve(n);
+            while (flow.size() < n) {
+                Command c = gen.next();
+                if (c.kind == CmdKind::Limit) flow.push_back({c.side, OrderType::Limit, c.price, c.qty, 0.0});
+                else if (c.kind == CmdKind::Market) flow.push_back({c.side, OrderType::Market, 0.0, c.qty, 0.0});
+            }
+            vector<ExecutionResults> results(n);
+
+            for (bool cold : {false, true}) {
+                BookConfig config;
+                config.ladderTicks = cold ? 64 : 8192;
+                config.reserveOrders = cold ? 0 : opt.reserve;
+                double single = 1e300;
+                long long expect = 0;
+                std::size_t singleGrowths = 0;
+                for (int round = 0; round < 5; ++round) {
+                    orderbook ob(config);
+                    auto start = clock::now();
+                    for (std::size_t i = 0; i < n; ++i) {
+                        const OrderCommand& o = flow[i];
+                        results[i] = o.type == OrderType::Limit ? ob.addLimitOrder(o.price, o.quantity, o.side)
+                                                                : ob.addMarketOrder(o.quantity, o.side);
+                    }
+                    single = std::min(single, std::chrono::duration<double, std::nano>(clock::now() - start).count());
+                    long long filled = 0;
+                    for (const auto& r : results) filled += r.filled;
+                    expect = filled;
+                    singleGrowths = ob.heapGrowths();
+                }
+                cout << std::left << std::setw(8) << workloadName(w) << std::setw(10) << (cold ? "cold" : "reserved") << std::right
+                     << std::setw(10) << n << std::setw(12) << single / static_cast<double>(n);
+
+                std::size_t batchGrowths = 0;
+                for (std::size_t slice : slices) {
+                    double best = 1e300;
+                    for (int round = 0; round < 5; ++round) {
+                        orderbook ob(config);
+                        auto start = clock::now();
+                        for (std::size_t i = 0; i < n; i += slice) ob.submitBatch(flow.data() + i, std::min(slice, n - i), results.data() + i);
+                        best = std::min(best, std::chrono::duration<double, std::nano>(clock::now() - start).count());
+                        long long filled = 0;
+                        for (const auto& r : results) filled += r.filled;
+                        if (filled != expect) {
+                            std::cerr << "batch filled " << filled << ", single calls " << expect << '\n';
+                            std::exit(1);
+                        }
+                        batchGrowths = ob.heapGrowths();
+                    }
+                    cout << std::setw(10) << best / static_cast<double>(n);
+                }
+                cout << std::setw(18) << (std::to_string(singleGrowths) + "/" + std::to_string(batchGrowths)) << std::endl;
+            }
+        }
+    }
+}
+
+// The mix flow against a book that also holds 100k stops: once with them all far from the
+// prices that trade (the cost of looking and finding nothing), once with them where the flow
+// trades so they keep going off (stop-limits, so most of them then rest and trade themselves),
+// and once with the far stops kept in a plain list that's scanned after every call that
+// traded, which is what the trigger heaps avoid. Stops go in before the clock starts. Best of 3.
+void runStops(const Options& opt) {
+    using clock = std::chrono::steady_clock;
+    constexpr std::size_t pending = 100000;
+    constexpr std::size_t scanOrders = 20000; // the scan is too slow for the whole flow
+    vector<std::size_t> sizes = opt.sizesGiven ? opt.sizes : vector<std::size_t>{1000000};
+
+    struct Stop {
+        double stopPrice;
+        double price;
+        int qty;
+        Side side;
+    };
+    auto makeStops = [&opt](bool near) {
+        Rng rng(opt.seed + 1);
+        vector<Stop> stops(pending);
+        for (Stop& s : stops) {
+            s.side = rng.chance(50) ? Side::Buy : Side::Sell;
+            // Buy stops above the middle and sell stops below, as they'd sit protecting positions.
+            if (s.side == Side::Buy) s.stopPrice = near ? 110.0 + rng.unit() * 15.0 : 200.0 + rng.unit() * 50.0;
+            else s.stopPrice = near ? 95.0 + rng.unit() * 15.0 : 1.0 + rng.unit() * 50.0;
+            s.price = s.side == Side::Buy ? s.stopPrice + 0.5 : s.stopPrice - 0.5;
+            s.qty = rng.uniform(1, 25);
+        }
+        return stops;
+    };
+
+    cout << std::left << std::setw(8) << "stops" << std::right << std::setw(10) << "orders" << std::setw(10) << "trades"
+         << std::setw(11) << "triggered" << std::setw(11) << "ns/order" << std::setw(18) << "+ns/trade vs none" << '\n';
+    cout << std::fixed << std::setprecision(1);
+    for (std::size_t n : sizes) {
+        FlowGenerator gen(Workload::Mix, opt.seed);
+        vector<Command> flow(n);
+        for (auto& c : flow) c = gen.next();
+
+        // Returns best ns for the first `count` commands, with the trade and trigger totals.
+        auto timeFlow = [&](const vector<Stop>& stops, std::size_t count, bool scan, long long& trades, long long& triggered) {
+            double best = 1e300;
+            for (int round = 0; round < 3; ++round) {
+                orderbook ob(makeBook(opt));
+                if (!scan) {
+                    for (const Stop& s : stops) ob.addStopLimitOrder(s.stopPrice, s.price, s.qty, s.side);
+                }
+                trades = triggered = 0;
+                long long hits = 0;
+                auto start = clock::now();
+                for (std::size_t i = 0; i < count; ++i) {
+                    const Command& c = flow[i];
+                    ExecutionResults r = c.kind == CmdKind::Limit ? ob.addLimitOrder(c.price, c.qty, c.side) : ob.addMarketOrder(c.qty, c.side);
+                    trades += r.trades + r.stopTrades;
+                    triggered += r.triggered;
+                    if (scan && r.trades) {
+                        double last = r.notional / r.filled; // near enough to the last print for a comparison
+                        for (const Stop& s : stops) hits += s.side == Side::Buy ? s.stopPrice <= last : s.stopPrice >= last;
+                    }
+                }
+                best = std::min(best, std::chrono::duration<double, std::nano>(clock::now() - start).count());
+                sink = sink + hits;
+            }
+            return best;
+        };
+
+        vector<Stop> none;
+        vector<Stop> far = makeStops(false);
+        vector<Stop> near = makeStops(true);
+        long long baseTrades = 0, trades = 0, triggered = 0;
+        double base = timeFlow(none, n, false, baseTrades, triggered);
+        auto row = [&](const char* name, std::size_t count, double ns, double againstNs, long long againstTrades) {
+            cout << std::left << std::setw(8) << name << std::right << std::setw(10) << count << std::setw(10) << trades
+                 << std::setw(11) << triggered << std::setw(11) << ns / static_cast<double>(count) << std::setw(18)
+                 << (againstTrades ? (ns - againstNs) / static_cast<double>(againstTrades) : 0.0) << std::endl;
+        };
+        trades = baseTrades;
+        row("none", n, base, base, baseTrades);
+        double farNs = timeFlow(far, n, false, trades, triggered);
+        if (trades != baseTrades || triggered != 0) {
+            std::cerr << "far stops changed the flow: " << trades << " trades, " << triggered << " triggered\n";
+            std::exit(1);
+        }
+        row("far", n, farNs, base, baseTrades);
+        double nearNs = timeFlow(near, n, false, trades, triggered);
+        row("near", n, nearNs, base, baseTrades);
+
+        long long scanBaseTrades = 0;
+        double scanBase = timeFlow(none, std::min(n, scanOrders), false, scanBaseTrades, triggered);
+        double scanNs = timeFlow(far, std::min(n, scanOrders), true, trades, triggered);
+        row("scan", std::min(n, scanOrders), scanNs, scanBase, scanBaseTrades);
+    }
+}
+
+// The mix flow with change capture on and the changes taken after every call, as the
+// sequencer does each pass: once dropping them, once feeding the trades to a CandleSet
+// (with the clock read the sequencer does once a pass). Best of 5, alternating.
+void runCandles(const Options& opt) {
+    using clock = std::chrono::steady_clock;
+    vector<std::size_t> sizes = opt.sizesGiven ? opt.sizes : vector<std::size_t>{1000000};
+
+    cout << std::left << std::setw(10) << "orders" << std::right << std::setw(10) << "trades" << std::setw(16) << "plain ns/order"
+         << std::setw(18) << "candles ns/order" << std::setw(14) << "+ns/trade" << std::setw(8) << "allocs" << '\n';
+    cout << std::fixed << std::setprecision(1);
+    for (std::size_t n : sizes) {
+        FlowGenerator gen(Workload::Mix, opt.seed);
+        vector<Command> flow(n);
+        for (auto& c : flow) c = gen.next();
+
+        long long trades = 0;
+        std::size_t allocs = 0;
+        auto timeFlow = [&](bool withCandles) {
+            orderbook ob(makeBook(opt));
+            ob.captureChanges(true);
+            CandleSet candles;
+            vector<LevelUpdate> levels;
+            vector<TradePrint> prints;
+            levels.reserve(1024);
+            prints.reserve(1024);
+            trades = 0;
+            std::size_t before = heapAllocations();
+            auto start = clock::now();
+            for (const Command& c : flow) {
+                execute(ob, c);
+                levels.clear();
+                prints.clear();
+                ob.takeChanges(levels, prints);
+                trades += static_cast<long long>(prints.size());
+                if (withCandles && !prints.empty()) candles.add(prints.data(), prints.size(), candleClock());
+            }
+            double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+            if (withCandles) allocs = heapAllocations() - before;
+            sink = sink + static_cast<long long>(candles.find(60)->size());
+            return ns;
+        };
+        // Alternating, so both see the same noise.
+        double plain = 1e300;
+        double withCandles = 1e300;
+        for (int round = 0; round < 5; ++round) {
+            plain = std::min(plain, timeFlow(false));
+            withCandles = std::min(withCandles, timeFlow(true));
+        }
+        cout << std::left << std::setw(10) << n << std::right << std::setw(10) << trades << std::setw(16) << plain / static_cast<double>(n)
+             << std::setw(18) << withCandles / static_cast<double>(n) << std::setw(14)
+             << (trades ? (withCandles - plain) / static_cast<double>(trades) : 0.0) << std::setw(8) << allocs << std::endl;
+    }
+}
+
+// What BookHandler did before json.h: one std::string key and a scan from the top of the
+// body per field, strtod for numbers, and an ostringstream per reply.
+namespace legacy {
+
+bool extractString(const std::string& body, const std::string& key, std::string& out) {
+    auto pos = body.find("\"" + key + "\"");
+    if (pos == std::string::npos) return false;
+    pos = body.find(':', pos);
+    if (pos == std::string::npos) return false;
+    ++pos;
+    while (pos < body.size() && std::isspace(static_cast<unsigned char>(body[pos]))) ++pos;
+    if (pos >= body.size() || body[pos] != '"') return false;
+    auto end = body.find('"', pos + 1);
+    if (end == std::string::npos) return false;
+    out = body.substr(pos + 1, end - pos - 1);
+    return true;
+}
+
+bool extractNumber(const std::string& body, const std::string& key, double& out) {
+    auto pos = body.find("\"" + key + "\"");
+    if (pos == std::string::npos) return false;
+    pos = body.find(':', pos);
+    if (pos == std::string::npos) return false;
+    ++pos;
+    while (pos < body.size() && std::isspace(static_cast<unsigned char>(body[pos]))) ++pos;
+    char* endPtr = nullptr;
+    out = std::strtod(body.c_str() + pos, &endPtr);
+    return endPtr != body.c_str() + pos;
+}
+
+int parseOrder(const std::string& body) {
+    std::string symbol, side, type;
+    double qty = 0.0, price = 0.0;
+    extractString(body, "symbol", symbol);
+    bool ok = extractString(body, "side", side) && extractString(body, "type", type) && extractNumber(body, "qty", qty);
+    if (ok && (type == "limit" || type == "Limit")) extractNumber(body, "price", price);
+    return ok ? static_cast<int>(qty) + (side == "buy" ? 1 : 0) : 0;
+}
+
+std::string book(const BookSnapshot& snap, std::optional<double> spread, std::uint64_t seq) {
+    std::ostringstream oss;
+    oss << "{\"bids\":[";
+    for (std::size_t i = 0; i < snap.bids.size(); ++i) {
+        if (i) oss << ',';
+        oss << "{\"price\":" << snap.bids[i].price << ",\"qty\":" << snap.bids[i].qty << ",\"orders\":" << snap.bids[i].orders << "}";
+    }
+    oss << "],\"asks\":[";
+    for (std::size_t i = 0; i < snap.asks.size(); ++i) {
+        if (i) oss << ',';
+        oss << "{\"price\":" << snap.asks[i].price << ",\"qty\":" << snap.asks[i].qty << ",\"orders\":" << snap.asks[i].orders << "}";
+    }
+    oss << "]";
+    if (spread) oss << ",\"spread\":" << *spread;
+    oss << ",\"seq\":" << seq << "}";
+    return oss.str();
+}
+
+std::string execution(const ExecutionResults& exec, long long latencyNs) {
+    double avg = exec.filled > 0 ? exec.notional / static_cast<double>(exec.filled) : 0.0;
+    std::ostringstream body;
+    body << "{\"status\":\"ok\"" << ",\"id\":" << exec.id << ",\"filled\":" << exec.filled << ",\"requested\":" << exec.requested
+         << ",\"trades\":" << exec.trades << ",\"avg_price\":" << avg << ",\"latency_ns\":" << latencyNs << "}";
+    return body.str();
+}
+
+} // namespace legacy
+
+// Inputs come from the mix flow: the bodies the web UI would send for its orders, the
+// results those orders got, and top-10 snapshots taken along the way. Each case runs over
+// all of them, best of 15; allocations are per call.
+void runJson(const Options& opt) {
+    using clock = std::chrono::steady_clock;
+    constexpr std::size_t samples = 1024;
+    constexpr int rounds = 100;
+    FlowGenerator gen(Workload::Mix, opt.seed);
+    orderbook ob(BookConfig{});
+    vector<string> bodies;
+    vector<ExecutionResults> results;
+    vector<BookSnapshot> snaps;
+    for (std::size_t i = 0; i < 200000 && bodies.size() < samples; ++i) {
+        Command c = gen.next();
+        ExecutionResults r = c.kind == CmdKind::Market ? ob.addMarketOrder(c.qty, c.side) : ob.addLimitOrder(c.price, c.qty, c.side);
+        if (i < 100000) continue; // let the book fill up first
+        std::ostringstream body;
+        body << "{\"symbol\":\"AAPL\",\"side\":\"" << (c.side == Side::Buy ? "buy" : "sell") << "\",\"type\":\""
+             << (c.kind == CmdKind::Market ? "market" : "limit") << '"';
+        if (c.kind != CmdKind::Market) body << ",\"price\":" << std::llround(c.price * 100) / 100.0;
+        body << ",\"qty\":" << c.qty << '}';
+        bodies.push_back(body.str());
+        results.push_back(r);
+        snaps.push_back(ob.snapshot(10));
+    }
+
+    auto time = [&](auto&& fn) {
+        double best = 1e300;
+        for (int round = 0; round < 15; ++round) {
+            auto start = clock::now();
+            for (int r = 0; r < rounds; ++r) {
+                for (std::size_t i = 0; i < samples; ++i) fn(i);
+            }
+            best = std::min(best, std::chrono::duration<double, std::nano>(clock::now() - start).count());
+        }
+        return best / (static_cast<double>(rounds) * samples);
+    };
+    auto allocs = [&](auto&& fn) {
+        std::size_t before = heapAllocations();
+        for (std::size_t i = 0; i < samples; ++i) fn(i);
+        return static_cast<double>(heapAllocations() - before) / samples;
+    };
+    std::string out;
+    json::OrderFields fields;
+    struct Case {
+        const char* name;
+        std::function<void(std::size_t)> before;
+        std::function<void(std::size_t)> after;
+    };
+    Case cases[] = {
+        {"parse /orders", [&](std::size_t i) { sink = sink + legacy::parseOrder(bodies[i]); },
+         [&](std::size_t i) { sink = sink + (json::parseOrder(bodies[i], fields) ? 0 : *fields.qty); }},
+        {"encode /orders", [&](std::size_t i) { sink = sink + static_cast<long long>(legacy::execution(results[i], 1234).size()); },
+         [&](std::size_t i) {
+             out.clear();
+             json::execution(out, results[i], true, 1234);
+             sink = sink + static_cast<long long>(out.size());
+         }},
+        {"encode /book", [&](std::size_t i) { sink = sink + static_cast<long long>(legacy::book(snaps[i], 0.01, i).size()); },
+         [&](std::size_t i) {
+             out.clear();
+             json::book(out, snaps[i], 0.01, i);
+             sink = sink + static_cast<long long>(out.size());
+         }},
+    };
+
+    cout << std::left << std::setw(16) << "case" << std::right << std::setw(12) << "before ns" << std::setw(12) << "after ns"
+         << std::setw(9) << "speedup" << std::setw(15) << "allocs before" << std::setw(14) << "allocs after" << '\n';
+    cout << std::fixed << std::setprecision(1);
+    for (auto& c : cases) {
+        double before = time(c.before);
+        double after = time(c.after);
+        cout << std::left << std::setw(16) << c.name << std::right << std::setw(12) << before << std::setw(12) << after
+             << std::setw(8) << before / after << 'x' << std::setw(15) << allocs(c.before) << std::setw(14) << allocs(c.after)
+             << std::endl;
+    }
+}
+
+vector<string> split(const string& s, char sep) {
+    vector<string> out;
+    std::stringstream ss(s);
+    string item;
+    while (std::getline(ss, item, sep)) out.push_back(item);
+    return out;
+}
+
+bool parseWorkload(const string& name, Workload& out) {
+    for (Workload w : {Workload::Mix, Workload::Deep, Workload::Cancel, Workload::Sweep}) {
+        if (name == workloadName(w)) { out = w; return true; }
+    }
+    return false;
+}
+
+// A book without change capture (every one here) must still move version() on a partial
+// fill, or a /book reply cached at the old version outlives it. Checked before every run.
+bool versionMovesOnFill() {
+    orderbook ob;
+    ob.addLimitOrder(100.0, 10, Side::Sell);
+    std::uint64_t before = ob.version();
+    ob.addMarketOrder(3, Side::Buy);
+    return ob.version() != before && ob.bestAsk() && ob.bestAsk()->qty == 7;
+}
+
+void usage() {
+    cout << "orderbook_bench [--sizes 1000,10000,...] [--workloads mix,deep,cancel,sweep] [--seed N]\n"
+            "                [--reserve N] [--csv out.csv] [--baseline old.csv] [--threshold pct]\n"
+            "orderbook_bench --shards 1,2,4,8 [--symbols N] [--producers N] [--orders N] [--seed N]\n"
+            "orderbook_bench --restore [--sizes N,...] [--seed N]\n"
+            "orderbook_bench --fills [--sizes N,...] [--workloads ...] [--seed N]\n"
+            "orderbook_bench --json [--seed N]\n"
+            "orderbook_bench --batch [--sizes N,...] [--workloads ...] [--seed N]\n"
+            "orderbook_bench --stops [--sizes N,...] [--seed N]\n"
+            "orderbook_bench --candles [--sizes N,...] [--seed N]\n"
+            "orderbook_bench --fixed [--sizes N,...] [--workloads ...] [--seed N]\n";
+}
+
+bool parseArgs(int argc, char** argv, Options& opt) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--restore" || arg == "--fills" || arg == "--json" || arg == "--batch" || arg == "--stops" || arg == "--candles" ||
+            arg == "--fixed") {
+            (arg == "--restore" ? opt.restore : arg == "--fills" ? opt.fills : arg == "--json" ? opt.json
+             : arg == "--batch" ? opt.batch : arg == "--stops" ? opt.stops : arg == "--candles" ? opt.candles : opt.fixed) = true;
+            continue;
+        }
+        if (arg == "-h" || arg == "--help" || i + 1 >= argc) return false;
+        string val = argv[++i];
+        if (arg == "--sizes") {
+            opt.sizesGiven = true;
+            opt.sizes.clear();
+            for (const auto& s : split(val, ',')) opt.sizes.push_back(std::stoull(s));
+        } else if (arg == "--workloads") {
+            opt.workloads.clear();
+            for (const auto& s : split(val, ',')) {
+                Workload w;
+                if (!parseWorkload(s, w)) return false;
+                opt.workloads.push_back(w);
+            }
+        } else if (arg == "--seed") {
+            opt.seed = std::stoull(val);
+        } else if (arg == "--reserve") {
+            opt.reserve = std::stoull(val);
+        } else if (arg == "--csv") {
+            opt.csvPath = val;
+        } else if (arg == "--baseline") {
+            opt.baselinePath = val;
+        } else if (arg == "--threshold") {
+            opt.threshold = std::stod(val);
+        } else if (arg == "--shards") {
+            for (const auto& s : split(val, ',')) opt.shards.push_back(std::max<std::size_t>(1, std::stoull(s)));
+        } else if (arg == "--symbols") {
+            opt.symbols = std::max<std::size_t>(1, std::stoull(val));
+        } else if (arg == "--producers") {
+            opt.producers = std::max<std::size_t>(1, std::stoull(val));
+        } else if (arg == "--orders") {
+            opt.shardOrders = std::stoull(val);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+void writeCsv(const string& path, const vector<Result>& results, const Options& opt) {
+    std::ofstream out(path);
+    out << "workload,orders,seed,ns_per_order,orders_per_sec,p50_ns,p99_ns,p999_ns,max_ns,allocs\n";
+    out << std::fixed << std::setprecision(1);
+    for (const auto& r : results) {
+        out << workloadName(r.workload) << ',' << r.orders << ',' << opt.seed << ',' << r.nsPerOrder << ','
+            << r.ordersPerSec << ',' << r.p50 << ',' << r.p99 << ',' << r.p999 << ',' << r.max << ',' << r.allocs << '\n';
+    }
+}
+
+// Returns false if any run got slower per order than the baseline by more than the threshold.
+bool compareBaseline(const string& path, const vector<Result>& results, double threshold) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "can't read baseline " << path << '\n';
+        return false;
+    }
+    std::map<string, vector<string>> rows;
+    string line;
+    std::getline(in, line); // header
+    while (std::getline(in, line)) {
+        auto cols = split(line, ',');
+        if (cols.size() >= 10) rows[cols[0] + "/" + cols[1]] = std::move(cols);
+    }
+
+    bool ok = true;
+    cout << "\nvs " << path << " (ns/order, p99):\n";
+    for (const auto& r : results) {
+        auto it = rows.find(string(workloadName(r.workload)) + "/" + std::to_string(r.orders));
+        if (it == rows.end()) continue;
+        double oldNs = std::stod(it->second[3]);
+        double oldP99 = std::stod(it->second[6]);
+        double delta = oldNs > 0 ? 100.0 * (r.nsPerOrder - oldNs) / oldNs : 0.0;
+        double deltaP99 = oldP99 > 0 ? 100.0 * (static_cast<double>(r.p99) - oldP99) / oldP99 : 0.0;
+        bool regressed = delta > threshold;
+        ok &= !regressed;
+        cout << std::left << std::setw(8) << workloadName(r.workload) << std::right << std::setw(10) << r.orders
+             << std::showpos << std::setw(9) << delta << "%" << std::setw(9) << deltaP99 << "%" << std::noshowpos
+             << (regressed ? "  REGRESSION" : "") << '\n';
+    }
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parseArgs(argc, argv, opt)) {
+        usage();
+        return 2;
+    }
+    if (!versionMovesOnFill()) {
+        std::cerr << "a partial fill left the book's version unchanged\n";
+        return 1;
+    }
+    if (!opt.shards.empty()) {
+        runSharded(opt);
+        return 0;
+    }
+    if (opt.restore) {
+        runRestore(opt);
+        return 0;
+    }
+    if (opt.fills) {
+        runFills(opt);
+        return 0;
+    }
+    if (opt.fixed) {
+        runFixed(opt);
+        return 0;
+    }
+    if (opt.json) {
+        runJson(opt);
+        return 0;
+    }
+    if (opt.batch) {
+        runBatch(opt);
+        return 0;
+    }
+    if (opt.stops) {
+        runStops(opt);
+        return 0;
+    }
+    if (opt.candles) {
+        runCandles(opt);
+        return 0;
+    }
+
+    cout << "seed " << opt.seed << ", reserve " << opt.reserve << " orders\n";
+    cout << std::left << std::setw(8) << "workload" << std::right << std::setw(10) << "orders" << std::setw(10) << "ns/order"
+         << std::setw(14) << "orders/s" << std::setw(8) << "p50" << std::setw(8) << "p99" << std::setw(9) << "p99.9"
+         << std::setw(10) << "max" << std::setw(8) << "allocs" << '\n';
+    cout << std::fixed << std::setprecision(1);
+
+    vector<Result> results;
+    for (Workload w : opt.workloads) {
+        for (std::size_t n : opt.sizes) {
+            Result r = run(w, n, opt);
+            results.push_back(r);
+            cout << std::left << std::setw(8) << workloadName(w) << std::right << std::setw(10) << n << std::setw(10) << r.nsPerOrder
+                 << std::setw(14) << std::setprecision(0) << r.ordersPerSec << std::setprecision(1) << std::setw(8) << r.p50
+                 << std::setw(8) << r.p99 << std::setw(9) << r.p999 << std::setw(10) << r.max << std::setw(8) << r.allocs << std::endl;
+        }
+    }
+
+    if (!opt.csvPath.empty()) writeCsv(opt.csvPath, results, opt);
+    if (!opt.baselinePath.empty() && !compareBaseline(opt.baselinePath, results, opt.threshold)) return 1;
+    return 0;
+}
@@ -0,0 +1,259 @@
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "binary_gateway.h"
+#include "binary_protocol.h"
+
+using tcp = boost::asio::ip::tcp;
+
+namespace {
+
+// One persistent connection. Every complete message in a read is decoded straight out of
+// the receive buffer and pushed to the sequencer, so a client can pipeline as many orders
+// as there are free slots. Replies are encoded into an output buffer that is written as
+// one batch while the next batch accumulates. All handlers run on the socket's strand.
+class BinarySession : public std::enable_shared_from_this<BinarySession> {
+public:
+    static constexpr std::size_t maxInFlight = 256;
+    static constexpr std::size_t bufferBytes = 64 * 1024;
+
+    BinarySession(tcp::socket socket, Sequencer& engine)
+        : socket_(std::move(socket)), engine_(engine), in_(bufferBytes / sizeof(std::uint64_t)) {
+        boost::system::error_code ec;
+        socket_.set_option(tcp::no_delay(true), ec);
+        for (std::size_t i = maxInFlight; i-- > 0;) free_.push_back(static_cast<std::uint16_t>(i));
+        out_.reserve(4096);
+        sending_.reserve(4096);
+    }
+
+    void run() { read(); }
+
+private:
+    // One command out at the engine.
+    struct Slot : EngineClient {
+        std::shared_ptr<BinarySession> owner; // keeps the session alive while the engine holds us
+        EngineCommand::Kind kind{};
+        std::uint32_t requestSeq{0};
+        OrderId id{0};
+
+        void engineDone() override {
+            auto self = std::move(owner);
+            boost::asio::post(self->socket_.get_executor(), [self, this] { self->complete(*this); });
+        }
+    };
+
+    tcp::socket socket_;
+    Sequencer& engine_;
+    std::vector<std::uint64_t> in_; // uint64 storage so messages land 8-aligned
+    std::size_t begin_{0};
+    std::size_t end_{0};
+    std::array<Slot, maxInFlight> slots_;
+    std::vector<std::uint16_t> free_;
+    std::vector<unsigned char> out_;
+    std::vector<unsigned char> sending_;
+    std::uint32_t expectedSeq_{1};
+    std::uint32_t outSeq_{0};
+    bool reading_{false};
+    bool writing_{false};
+    bool paused_{false};  // out of slots; resume decoding when a reply frees one
+    bool closed_{false};
+
+    unsigned char* bytes() { return reinterpret_cast<unsigned char*>(in_.data()); }
+
+    void read() {
+        if (reading_ || closed_) return;
+        reading_ = true;
+        auto self = shared_from_this();
+        socket_.async_read_some(boost::asio::buffer(bytes() + end_, bufferBytes - end_), [self](auto ec, std::size_t n) {
+            self->reading_ = false;
+            if (ec) {
+                self->close();
+                return;
+            }
+            self->end_ += n;
+            self->drain();
+        });
+    }
+
+    void drain() {
+        while (!closed_ && end_ - begin_ >= sizeof(wire::MsgHeader)) {
+            const unsigned char* p = bytes() + begin_;
+            const auto& header = *reinterpret_cast<const wire::MsgHeader*>(p);
+            std::size_t size = header.type == wire::NewOrder ? sizeof(wire::NewOrderMsg)
+                             : header.type == wire::Cancel   ? sizeof(wire::CancelMsg)
+                                                             : 0;
+            // No way to find the next message boundary after garbage, so drop the connection.
+            if (size == 0 || header.length != size || header.version != wire::version) {
+                close();
+                return;
+            }
+            if (end_ - begin_ < size) break;
+            if (free_.empty()) {
+                paused_ = true;
+                break;
+            }
+            begin_ += size;
+
+            // Out of order: drop it and keep waiting for the one we expected.
+            if (header.seq != expectedSeq_) {
+                reject(header.seq, wire::SequenceGap);
+                continue;
+            }
+            ++expectedSeq_;
+            if (header.type == wire::NewOrder) newOrder(*reinterpret_cast<const wire::NewOrderMsg*>(p));
+            else cancel(*reinterpret_cast<const wire::CancelMsg*>(p));
+        }
+        // Keep the partial tail at the (aligned) front for the next read.
+        std::memmove(bytes(), bytes() + begin_, end_ - begin_);
+        end_ -= begin_;
+        begin_ = 0;
+        flush();
+        if (!paused_) read();
+    }
+
+    static bool parseSymbol(const char (&text)[16], Symbol& out) {
+        return Symbol::parse(std::string_view(text, strnlen(text, sizeof(text))), out);
+    }
+
+    void newOrder(const wire::NewOrderMsg& msg) {
+        Symbol symbol;
+        if (!parseSymbol(msg.symbol, symbol)) return reject(msg.header.seq, wire::BadSymbol);
+        bool limit = msg.orderType == 0;
+        if (msg.side > 1 || msg.orderType > 1 || msg.qty <= 0 || (limit && msg.price <= 0)) {
+            return reject(msg.header.seq, wire::BadMessage);
+        }
+        Side side = msg.side == 0 ? Side::Buy : Side::Sell;
+        double price = static_cast<double>(msg.price) / static_cast<double>(wire::priceScale);
+        submit(EngineCommand{limit ? EngineCommand::Kind::Limit : EngineCommand::Kind::Market, side, limit, msg.qty,
+                             price, 0, 0, symbol, nullptr},
+               msg.header.seq);
+    }
+
+    void cancel(const wire::CancelMsg& msg) {
+        Symbol symbol;
+        if (!parseSymbol(msg.symbol, symbol)) return reject(msg.header.seq, wire::BadSymbol);
+        submit(EngineCommand{EngineCommand::Kind::Cancel, Side::Buy, false, 0, 0.0, msg.orderId, 0, symbol, nullptr},
+               msg.header.seq);
+    }
+
+    void submit(EngineCommand cmd, std::uint32_t requestSeq) {
+        Slot& slot = slots_[free_.back()];
+        free_.pop_back();
+        slot.kind = cmd.kind;
+        slot.requestSeq = requestSeq;
+        slot.id = cmd.id;
+        slot.owner = shared_from_this();
+        cmd.client = &slot;
+        engine_.submit(ioThread, cmd);
+    }
+
+    // Back on the strand with the engine's reply for one slot.
+    void complete(Slot& slot) {
+        const EngineReply& reply = slot.reply;
+        if (slot.kind == EngineCommand::Kind::Cancel) {
+            if (reply.found) ack(slot.requestSeq, wire::Cancelled, slot.id);
+            else reject(slot.requestSeq, wire::UnknownOrder);
+        } else if (reply.exec.rejected) {
+            reject(slot.requestSeq, wire::PriceOutOfRange);
+        } else {
+            const ExecutionResults& exec = reply.exec;
+            ack(slot.requestSeq, wire::Accepted, exec.id);
+            if (exec.filled > 0) {
+                wire::FillMsg msg{};
+                msg.requestSeq = slot.requestSeq;
+                msg.filled = exec.filled;
+                msg.avgPrice = std::llround(exec.notional / exec.filled * static_cast<double>(wire::priceScale));
+                msg.orderId = exec.id;
+                msg.trades = static_cast<std::uint32_t>(exec.trades);
+                send(msg, wire::Fill);
+            }
+        }
+        free_.push_back(static_cast<std::uint16_t>(&slot - slots_.data()));
+        if (paused_) {
+            paused_ = false;
+            drain();
+        } else {
+            flush();
+        }
+    }
+
+    void ack(std::uint32_t requestSeq, wire::AckKind kind, OrderId id) {
+        wire::AckMsg msg{};
+        msg.requestSeq = requestSeq;
+        msg.kind = kind;
+        msg.orderId = id;
+        send(msg, wire::Ack);
+    }
+
+    void reject(std::uint32_t requestSeq, wire::RejectReason reason) {
+        wire::RejectMsg msg{};
+        msg.requestSeq = requestSeq;
+        msg.reason = reason;
+        send(msg, wire::Reject);
+    }
+
+    template <typename Msg>
+    void send(Msg& msg, wire::MsgType type) {
+        msg.header = wire::MsgHeader{static_cast<std::uint16_t>(sizeof(Msg)), type, wire::version, ++outSeq_};
+        std::size_t at = out_.size();
+        out_.resize(at + sizeof(Msg));
+        std::memcpy(out_.data() + at, &msg, sizeof(Msg));
+    }
+
+    void flush() {
+        if (writing_ || closed_ || out_.empty()) return;
+        writing_ = true;
+        std::swap(out_, sending_);
+        auto self = shared_from_this();
+        boost::asio::async_write(socket_, boost::asio::buffer(sending_), [self](auto ec, auto) {
+            self->writing_ = false;
+            self->sending_.clear();
+            if (ec) {
+                self->close();
+                return;
+            }
+            self->flush();
+        });
+    }
+
+    // Replies still owed by the engine arrive later and are simply dropped.
+    void close() {
+        if (closed_) return;
+        closed_ = true;
+        boost::system::error_code ec;
+        socket_.close(ec);
+    }
+};
+
+class BinaryListener : public std::enable_shared_from_this<BinaryListener> {
+public:
+    BinaryListener(boost::asio::io_context& ioc, tcp::endpoint ep, Sequencer& engine)
+        : ioc_(ioc), acceptor_(ioc), engine_(engine) {
+        acceptor_.open(ep.protocol());
+        acceptor_.set_option(boost::asio::socket_base::reuse_address(true));
+        acceptor_.bind(ep);
+        acceptor_.listen(boost::asio::socket_base::max_listen_connections);
+    }
+    void run() { accept(); }
+private:
+    boost::asio::io_context& ioc_;
+    tcp::acceptor acceptor_;
+    Sequencer& engine_;
+    void accept() {
+        // Each session gets its own strand: replies come back from the engine while a read may be pending.
+        acceptor_.async_accept(boost::asio::make_strand(ioc_), [self=shared_from_this()](auto ec, auto socket) {
+            if (!ec) std::make_shared<BinarySession>(std::move(socket), self->engine_)->run();
+            self->accept();
+        });
+    }
+};
+
+} // namespace
+
+void startBinaryGateway(boost::asio::io_context& ioc, tcp::endpoint ep, Sequencer& engine) {
+    std::make_shared<BinaryListener>(ioc, ep, engine)->run();
+}
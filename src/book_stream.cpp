@@ -0,0 +1,207 @@
+#include <boost/beast/core.hpp>
+#include <boost/beast/websocket.hpp>
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <utility>
+
+#include "book_stream.h"
+#include "json.h"
+
+using tcp = boost::asio::ip::tcp;
+namespace http = boost::beast::http;
+namespace websocket = boost::beast::websocket;
+
+namespace {
+
+// Prices are whole ticks, and to_chars prints the shortest form that reads back as the same
+// double, so they come out as 100.01, not 100.010000000000002.
+std::string updateJson(const BookUpdate& update) {
+    std::string text;
+    json::Writer out(text);
+    out << "{\"type\":\"update\",\"symbol\":\"" << update.symbol.view() << "\",\"seq\":" << update.seq;
+    for (Side side : {Side::Buy, Side::Sell}) {
+        out << (side == Side::Buy ? ",\"bids\":[" : ",\"asks\":[");
+        bool first = true;
+        for (const LevelUpdate& level : update.levels) {
+            if (level.side != side) continue;
+            if (!first) out << ',';
+            first = false;
+            out << "{\"price\":" << level.price << ",\"qty\":" << level.qty << ",\"orders\":" << level.orders << '}';
+        }
+        out << ']';
+    }
+    out << ",\"trades\":[";
+    for (std::size_t i = 0; i < update.trades.size(); ++i) {
+        const TradePrint& trade = update.trades[i];
+        if (i) out << ',';
+        out << "{\"price\":" << trade.price << ",\"qty\":" << trade.qty << ",\"side\":\""
+            << (trade.aggressor == Side::Buy ? "buy" : "sell") << "\"}";
+    }
+    out << "]}";
+    return text;
+}
+
+} // namespace
+
+// One subscriber. Everything after the handshake runs on the socket's strand. Updates that
+// show up before the snapshot reply are parked and replayed past the snapshot's seq.
+class StreamSession : public std::enable_shared_from_this<StreamSession>, public EngineClient {
+public:
+    // A client this far behind is dropped; it reconnects and starts from a fresh snapshot.
+    static constexpr std::size_t maxQueued = 1024;
+
+    StreamSession(tcp::socket socket, StreamHub& hub, const Symbol& symbol)
+        : ws_(std::move(socket)), hub_(hub), symbol_(symbol) {}
+
+    void run(http::request<http::string_body> req) {
+        auto self = shared_from_this();
+        ws_.text(true);
+        ws_.auto_fragment(false); // one frame per update
+        ws_.async_accept(req, [self](auto ec) {
+            if (ec) return;
+            self->read();
+            self->hub_.subscribe(self->symbol_, self);
+        });
+    }
+
+    // Called on the hub's strand once we're on the subscriber list, so no update after the
+    // snapshot can be missed.
+    void requestSnapshot(Sequencer& engine) {
+        inFlight_ = shared_from_this();
+        engine.submit(ioThread, EngineCommand{EngineCommand::Kind::Book, Side::Buy, false, 0, 0.0, 0,
+                                              std::numeric_limits<std::size_t>::max(), symbol_, this});
+    }
+
+    void engineDone() override {
+        auto self = std::move(inFlight_);
+        boost::asio::post(ws_.get_executor(), [self] { self->sendSnapshot(); });
+    }
+
+    // Any thread.
+    void deliver(std::uint64_t seq, std::shared_ptr<const std::string> text) {
+        boost::asio::post(ws_.get_executor(), [self = shared_from_this(), seq, text = std::move(text)]() mutable {
+            if (!self->live_) {
+                self->early_.emplace_back(seq, std::move(text));
+                return;
+            }
+            if (seq > self->snapshotSeq_) self->enqueue(std::move(text));
+        });
+    }
+
+private:
+    websocket::stream<tcp::socket> ws_;
+    StreamHub& hub_;
+    Symbol symbol_;
+    boost::beast::flat_buffer in_;
+    std::deque<std::shared_ptr<const std::string>> queue_;
+    std::vector<std::pair<std::uint64_t, std::shared_ptr<const std::string>>> early_;
+    std::uint64_t snapshotSeq_{0};
+    bool live_{false};
+    bool writing_{false};
+    bool closed_{false};
+    std::shared_ptr<StreamSession> inFlight_; // keeps us alive while the engine holds `this`
+
+    void sendSnapshot() {
+        std::string text;
+        json::Writer out(text);
+        out << "{\"type\":\"snapshot\",\"symbol\":\"" << symbol_.view() << "\",\"seq\":" << reply.bookSeq << ",\"bids\":[";
+        json::levels(out, reply.book.bids);
+        out << "],\"asks\":[";
+        json::levels(out, reply.book.asks);
+        out << "]}";
+        snapshotSeq_ = reply.bookSeq;
+        live_ = true;
+        enqueue(std::make_shared<const std::string>(std::move(text)));
+        for (auto& [seq, text] : early_) {
+            if (seq > snapshotSeq_) enqueue(std::move(text));
+        }
+        early_.clear();
+        early_.shrink_to_fit();
+    }
+
+    void enqueue(std::shared_ptr<const std::string> text) {
+        if (closed_) return;
+        if (queue_.size() >= maxQueued) {
+            close();
+            return;
+        }
+        queue_.push_back(std::move(text));
+        write();
+    }
+
+    void write() {
+        if (writing_ || closed_ || queue_.empty()) return;
+        writing_ = true;
+        auto self = shared_from_this();
+        ws_.async_write(boost::asio::buffer(*queue_.front()), [self](auto ec, auto) {
+            self->writing_ = false;
+            if (ec) {
+                self->close();
+                return;
+            }
+            self->queue_.pop_front();
+            self->write();
+        });
+    }
+
+    // Nothing is expected from the client; reading keeps ping/close handling going.
+    void read() {
+        auto self = shared_from_this();
+        ws_.async_read(in_, [self](auto ec, std::size_t n) {
+            if (ec) {
+                self->close();
+                return;
+            }
+            self->in_.consume(n);
+            self->read();
+        });
+    }
+
+    void close() {
+        if (closed_) return;
+        closed_ = true;
+        queue_.clear();
+        boost::system::error_code ec;
+        ws_.next_layer().close(ec);
+    }
+};
+
+StreamHub::StreamHub(boost::asio::io_context& ioc, Sequencer& engine)
+    : strand_(boost::asio::make_strand(ioc)), engine_(engine) {}
+
+void StreamHub::accept(tcp::socket socket, http::request<http::string_body> req, const Symbol& symbol) {
+    std::make_shared<StreamSession>(std::move(socket), *this, symbol)->run(std::move(req));
+}
+
+void StreamHub::subscribe(const Symbol& symbol, const std::shared_ptr<StreamSession>& session) {
+    boost::asio::post(strand_, [this, symbol, session] {
+        auto [it, added] = subscribers_.try_emplace(symbol);
+        // Before the snapshot request: the ring hands this to the shard along with it.
+        if (added) watched(symbol).fetch_add(1, std::memory_order_relaxed);
+        it->second.push_back(session);
+        session->requestSnapshot(engine_);
+    });
+}
+
+bool StreamHub::wants(const Symbol& symbol) const {
+    return watched_[SymbolHash{}(symbol) % watched_.size()].load(std::memory_order_relaxed) != 0;
+}
+
+void StreamHub::publish(std::shared_ptr<const BookUpdate> update) {
+    boost::asio::post(strand_, [this, update = std::move(update)] {
+        auto it = subscribers_.find(update->symbol);
+        if (it == subscribers_.end()) return; // nobody watching: don't even serialise it
+        auto& list = it->second;
+        list.erase(std::remove_if(list.begin(), list.end(), [](const auto& weak) { return weak.expired(); }), list.end());
+        if (list.empty()) {
+            watched(update->symbol).fetch_sub(1, std::memory_order_relaxed);
+            subscribers_.erase(it);
+            return;
+        }
+        auto text = std::make_shared<const std::string>(updateJson(*update));
+        for (const auto& weak : list) {
+            if (auto session = weak.lock()) session->deliver(update->seq, text);
+        }
+    });
+}
@@ -0,0 +1,162 @@
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <random>
+
+#include <zlib.h>
+
+#include "http_cache.h"
+
+namespace {
+
+// Trim spaces and tabs off both ends.
+std::string_view trim(std::string_view text) {
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) text.remove_prefix(1);
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) text.remove_suffix(1);
+    return text;
+}
+
+// Calls fn on each comma-separated item, trimmed, until it returns true.
+template <typename Fn>
+bool anyItem(std::string_view list, Fn fn) {
+    while (!list.empty()) {
+        auto comma = list.find(',');
+        if (fn(trim(list.substr(0, comma)))) return true;
+        if (comma == std::string_view::npos) break;
+        list.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+std::string gzip(const std::string& data) {
+    z_stream zs{};
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return {}; // +16: gzip wrapper
+    std::string out(deflateBound(&zs, data.size()), '\0');
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    zs.avail_in = static_cast<uInt>(data.size());
+    zs.next_out = reinterpret_cast<Bytef*>(out.data());
+    zs.avail_out = static_cast<uInt>(out.size());
+    int rc = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return rc == Z_STREAM_END ? out : std::string();
+}
+
+std::string_view contentType(const std::filesystem::path& file) {
+    auto ext = file.extension().string();
+    if (ext == ".html") return "text/html; charset=utf-8";
+    if (ext == ".js") return "text/javascript; charset=utf-8";
+    if (ext == ".css") return "text/css; charset=utf-8";
+    if (ext == ".json") return "application/json";
+    if (ext == ".svg") return "image/svg+xml";
+    if (ext == ".png") return "image/png";
+    if (ext == ".ico") return "image/x-icon";
+    return "application/octet-stream";
+}
+
+// FNV-1a, as for symbols.
+std::uint64_t hash(std::string_view data) {
+    std::uint64_t h = 1469598103934665603ull;
+    for (char c : data) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+} // namespace
+
+BookCache::BookCache() {
+    std::random_device rd;
+    boot_ = (static_cast<std::uint64_t>(rd()) << 32) ^ rd() ^
+            static_cast<std::uint64_t>(std::chrono::system_clock::now().time_since_epoch().count());
+}
+
+std::string_view BookCache::etag(std::uint64_t version, char* buf) const {
+    char* p = buf;
+    *p++ = '"';
+    p = std::to_chars(p, buf + etagSize, boot_ & 0xffffffffull, 16).ptr;
+    *p++ = '-';
+    p = std::to_chars(p, buf + etagSize, version).ptr;
+    *p++ = '"';
+    return {buf, static_cast<std::size_t>(p - buf)};
+}
+
+bool BookCache::find(const Symbol& symbol, std::size_t depth, std::uint64_t version, std::string& out) const {
+    std::shared_lock lock(mutex_);
+    auto it = entries_.find(Key{symbol, depth});
+    if (it == entries_.end() || it->second.version != version) return false;
+    out.assign(it->second.body);
+    return true;
+}
+
+void BookCache::store(const Symbol& symbol, std::size_t depth, std::uint64_t version, std::string_view body) {
+    // Version 0 is an empty or missing book: cheap to build, and caching it would let
+    // polls of made-up symbols grow the map.
+    if (version == 0) return;
+    std::unique_lock lock(mutex_);
+    Key key{symbol, depth};
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+        if (entries_.size() >= maxEntries) entries_.clear();
+        it = entries_.emplace(key, Entry{}).first;
+    } else if (it->second.version >= version) {
+        return; // someone beat us to it with the same or a later snapshot
+    }
+    it->second.version = version;
+    it->second.body.assign(body);
+}
+
+void StaticAssets::load(const std::string& dir) {
+    std::error_code ec;
+    for (const auto& file : std::filesystem::directory_iterator(dir, ec)) {
+        if (!file.is_regular_file(ec)) continue;
+        std::ifstream in(file.path(), std::ios::binary);
+        if (!in) continue;
+        Asset asset;
+        asset.contentType = contentType(file.path());
+        asset.body.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        asset.gzipped = gzip(asset.body);
+        if (asset.gzipped.size() >= asset.body.size()) asset.gzipped.clear();
+        char tag[24];
+        tag[0] = '"';
+        char* end = std::to_chars(tag + 1, tag + sizeof(tag) - 1, hash(asset.body), 16).ptr;
+        *end++ = '"';
+        asset.etag.assign(tag, end);
+        asset.gzipEtag = asset.etag;
+        asset.gzipEtag.insert(asset.gzipEtag.size() - 1, "-gz");
+
+        std::string name = file.path().filename().string();
+        if (name == "index.html") assets_["/"] = asset;
+        assets_["/" + name] = std::move(asset);
+        ++files_;
+    }
+}
+
+const StaticAssets::Asset* StaticAssets::find(std::string_view path) const {
+    auto it = assets_.find(path);
+    return it == assets_.end() ? nullptr : &it->second;
+}
+
+bool etagMatches(std::string_view ifNoneMatch, std::string_view etag) {
+    return anyItem(ifNoneMatch, [etag](std::string_view tag) {
+        if (tag.substr(0, 2) == "W/") tag.remove_prefix(2);
+        return tag == "*" || tag == etag;
+    });
+}
+
+bool acceptsGzip(std::string_view acceptEncoding) {
+    return anyItem(acceptEncoding, [](std::string_view item) {
+        auto semi = item.find(';');
+        if (trim(item.substr(0, semi)) != "gzip") return false;
+        if (semi == std::string_view::npos) return true;
+        // "gzip;q=0" (or 0.0, 0.000) turns it off; any other weight leaves it on.
+        auto q = trim(item.substr(semi + 1));
+        if (q.substr(0, 2) != "q=") return true;
+        q.remove_prefix(2);
+        return q.find_first_not_of("0.") != std::string_view::npos;
+    });
+}
@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+namespace {
+
+constexpr char magic[8] = {'O', 'B', 'J', 'R', 'N', 'L', '\0', '\0'};
+constexpr std::uint32_t version = 1;
+
+struct FileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t recordSize;
+};
+
+static_assert(sizeof(FileHeader) == Journal::headerBytes);
+
+bool writeAll(int fd, const char* data, std::size_t size) {
+    while (size) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+} // namespace
+
+// Five 64-bit words through a multiply/xorshift mix: cheap, and a torn or zeroed record
+// won't pass by accident.
+std::uint64_t JournalRecord::hash() const {
+    std::uint64_t words[5];
+    std::memcpy(words, this, sizeof(words));
+    std::uint64_t h = 0x9e3779b97f4a7c15ull;
+    for (std::uint64_t w : words) {
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+Journal::Journal(const JournalConfig& config, std::size_t producers, std::size_t validBytes) : config_(config) {
+    fd_ = ::open(config_.path.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (fd_ < 0) throw std::runtime_error("can't open journal " + config_.path + ": " + std::strerror(errno));
+    if (::ftruncate(fd_, static_cast<off_t>(validBytes)) != 0 || ::lseek(fd_, 0, SEEK_END) < 0) {
+        ::close(fd_);
+        throw std::runtime_error("can't prepare journal " + config_.path + ": " + std::strerror(errno));
+    }
+    if (validBytes == 0) {
+        FileHeader header{};
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.recordSize = sizeof(JournalRecord);
+        if (!writeAll(fd_, reinterpret_cast<const char*>(&header), sizeof(header))) {
+            ::close(fd_);
+            throw std::runtime_error("can't write journal header: " + std::string(std::strerror(errno)));
+        }
+    }
+    for (std::size_t p = 0; p < producers; ++p) rings_.push_back(std::make_unique<SpscRing<JournalRecord, ringCapacity>>());
+}
+
+Journal::~Journal() {
+    stop();
+    if (fd_ >= 0) ::close(fd_);
+}
+
+void Journal::start() {
+    if (running_.exchange(true)) return;
+    thread_ = std::thread([this] { loop(); });
+}
+
+void Journal::stop() {
+    if (!running_.exchange(false)) return;
+    if (thread_.joinable()) thread_.join();
+}
+
+void Journal::append(std::size_t producer, const JournalRecord& record) {
+    auto& ring = *rings_[producer];
+    while (!ring.tryPush(record)) std::this_thread::yield(); // writer is behind: the disk sets the pace
+}
+
+void Journal::sync() {
+    if (::fdatasync(fd_) != 0) std::cerr << "journal fsync failed: " << std::strerror(errno) << '\n';
+}
+
+void Journal::loop() {
+    std::vector<char> batch;
+    batch.reserve(config_.batchBytes);
+    std::size_t perRing = std::max<std::size_t>(config_.batchBytes / sizeof(JournalRecord) / rings_.size(), 1);
+    auto lastSync = std::chrono::steady_clock::now();
+    bool unsynced = false;
+    bool failed = false;
+
+    for (;;) {
+        bool stopping = !running_.load(std::memory_order_acquire);
+        for (auto& ring : rings_) {
+            ring->consume(perRing, [&batch](const JournalRecord& record) {
+                const char* bytes = reinterpret_cast<const char*>(&record);
+                batch.insert(batch.end(), bytes, bytes + sizeof(record));
+            });
+        }
+
+        if (!batch.empty()) {
+            if (!writeAll(fd_, batch.data(), batch.size()) && !failed) {
+                std::cerr << "journal write failed, later commands won't survive a restart: " << std::strerror(errno) << '\n';
+                failed = true;
+            }
+            batch.clear();
+            unsynced = true;
+            if (config_.fsync == FsyncPolicy::EveryBatch) {
+                sync();
+                unsynced = false;
+            }
+            continue; // keep draining while there's work
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (unsynced && config_.fsync == FsyncPolicy::Interval && now - lastSync >= config_.fsyncInterval) {
+            sync();
+            unsynced = false;
+            lastSync = now;
+        }
+        if (stopping) break; // the pass above started after stop(), so the rings are empty
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    if (unsynced && config_.fsync != FsyncPolicy::Never) sync();
+}
+
+ReplayStats Journal::replay(const std::string& path, const std::function<void(const JournalRecord&)>& fn, std::size_t from) {
+    ReplayStats stats;
+    auto start = std::chrono::steady_clock::now();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) return stats;
+        throw std::runtime_error("can't open journal " + path + ": " + std::strerror(errno));
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("can't stat journal " + path);
+    }
+    std::size_t size = static_cast<std::size_t>(st.st_size);
+    if (size < sizeof(FileHeader)) { // empty, or died before the header made it out
+        ::close(fd);
+        return stats;
+    }
+    void* map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) throw std::runtime_error("can't map journal " + path + ": " + std::strerror(errno));
+    ::madvise(map, size, MADV_SEQUENTIAL);
+
+    const char* base = static_cast<const char*>(map);
+    FileHeader header;
+    std::memcpy(&header, base, sizeof(header));
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version ||
+        header.recordSize != sizeof(JournalRecord)) {
+        ::munmap(map, size);
+        throw std::runtime_error(path + " is not a version " + std::to_string(version) + " journal");
+    }
+
+    // The header is 16 bytes and records 48, so every record is 8-aligned in the mapping.
+    std::size_t offset = std::max(from, sizeof(FileHeader));
+    if (offset > size || (offset - sizeof(FileHeader)) % sizeof(JournalRecord) != 0) {
+        ::munmap(map, size);
+        throw std::runtime_error("journal offset " + std::to_string(from) + " is not a record boundary in " + path);
+    }
+    while (offset + sizeof(JournalRecord) <= size) {
+        const auto& record = *reinterpret_cast<const JournalRecord*>(base + offset);
+        if (!record.intact()) break;
+        fn(record);
+        offset += sizeof(JournalRecord);
+        ++stats.records;
+    }
+    stats.validBytes = offset;
+    ::munmap(map, size);
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
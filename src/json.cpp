@@ -0,0 +1,320 @@
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+#include "json.h"
+
+namespace json {
+
+namespace {
+
+// Cursor over a request body; each read skips the whitespace in front of what it reads.
+struct Reader {
+    const char* p;
+    const char* end;
+
+    void skip() {
+        while (p != end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p;
+    }
+    bool eat(char c) {
+        skip();
+        if (p == end || *p != c) return false;
+        ++p;
+        return true;
+    }
+    bool string(std::string_view& out) {
+        if (!eat('"')) return false;
+        const char* start = p;
+        for (; p != end && *p != '"'; ++p) {
+            if (*p == '\\' || static_cast<unsigned char>(*p) < 0x20) return false;
+        }
+        if (p == end) return false;
+        out = std::string_view(start, static_cast<std::size_t>(p - start));
+        ++p;
+        return true;
+    }
+    // JSON numbers start with '-' or a digit; from_chars would also take "inf", ".5" and so on.
+    bool number(double& out) {
+        skip();
+        if (p == end || (*p != '-' && (*p < '0' || *p > '9'))) return false;
+        auto [next, ec] = std::from_chars(p, end, out);
+        if (ec != std::errc()) return false;
+        p = next;
+        return std::isfinite(out);
+    }
+};
+
+enum Field : unsigned { SymbolField, SideField, TypeField, PriceField, QtyField, StopPriceField, fieldCount };
+
+// Well short of where the books' tick maths runs out (2^52 ticks, ~4.5e13 at a 0.01 tick).
+constexpr double maxPrice = 1e12;
+
+// Number and literal formatting straight into a char buffer; callers make sure there's room
+// (32 bytes covers any number).
+char* put(char* p, std::string_view text) {
+    std::memcpy(p, text.data(), text.size());
+    return p + text.size();
+}
+
+template <typename T>
+char* putInt(char* p, T value) {
+    return std::to_chars(p, p + 32, value).ptr;
+}
+
+// Prices are whole ticks, so nearly every double printed here is a short decimal. Find the
+// fewest decimals (up to 8) whose value reads back as exactly this double, and print that
+// as an integer with the point put in: the same text to_chars' shortest form would give,
+// for a fraction of the cost. A multiply screens each candidate before the exact check
+// divides. Anything else goes to to_chars.
+char* putDouble(char* p, double value) {
+    static constexpr double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8};
+    static constexpr std::int64_t ipow10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+    double magnitude = std::fabs(value);
+    for (int k = 0; k <= 8; ++k) {
+        double x = magnitude * pow10[k];
+        if (!(x < 0x1p53)) break;
+        auto scaled = static_cast<std::int64_t>(x + 0.5);
+        double off = x - static_cast<double>(scaled);
+        if (off > x * 1e-12 || -off > x * 1e-12) continue;
+        if (static_cast<double>(scaled) / pow10[k] != magnitude) continue;
+        if (std::signbit(value) && scaled != 0) *p++ = '-';
+        p = putInt(p, scaled / ipow10[k]);
+        if (k > 0) {
+            *p++ = '.';
+            std::int64_t frac = scaled % ipow10[k];
+            for (int d = k - 1; d >= 0; --d, frac /= 10) p[d] = static_cast<char>('0' + frac % 10);
+            p += k;
+        }
+        return p;
+    }
+    return std::to_chars(p, p + 32, value).ptr;
+}
+
+} // namespace
+
+Writer& Writer::operator<<(double value) {
+    char buf[32];
+    out_.append(buf, putDouble(buf, value));
+    return *this;
+}
+
+// The /book and stream hot loop, so each level is put together on the stack and appended once.
+void levels(Writer& out, const std::vector<BookLevel>& levels) {
+    for (std::size_t i = 0; i < levels.size(); ++i) {
+        char buf[128];
+        char* p = buf;
+        if (i) *p++ = ',';
+        p = put(p, "{\"price\":");
+        p = putDouble(p, levels[i].price);
+        p = put(p, ",\"qty\":");
+        p = putInt(p, levels[i].qty);
+        p = put(p, ",\"orders\":");
+        p = putInt(p, levels[i].orders);
+        *p++ = '}';
+        out << std::string_view(buf, static_cast<std::size_t>(p - buf));
+    }
+}
+
+void book(std::string& out, const BookSnapshot& snap, std::optional<double> spread, std::uint64_t seq) {
+    Writer w(out);
+    w << "{\"bids\":[";
+    levels(w, snap.bids);
+    w << "],\"asks\":[";
+    levels(w, snap.asks);
+    w << ']';
+    if (spread) w << ",\"spread\":" << *spread;
+    w << ",\"seq\":" << seq << '}';
+}
+
+void execution(std::string& out, const ExecutionResults& exec, bool withId, long long latencyNs) {
+    double avg = exec.filled > 0 ? exec.notional / static_cast<double>(exec.filled) : 0.0;
+    char buf[256];
+    char* p = put(buf, "{\"status\":\"ok\"");
+    if (withId) p = putInt(put(p, ",\"id\":"), exec.id);
+    p = putInt(put(p, ",\"filled\":"), exec.filled);
+    p = putInt(put(p, ",\"requested\":"), exec.requested);
+    p = putInt(put(p, ",\"trades\":"), exec.trades);
+    p = putDouble(put(p, ",\"avg_price\":"), avg);
+    if (exec.triggered) p = putInt(put(p, ",\"triggered\":"), exec.triggered);
+    p = putInt(put(p, ",\"latency_ns\":"), latencyNs);
+    *p++ = '}';
+    out.append(buf, p);
+}
+
+void batch(std::string& out, const std::vector<ExecutionResults>& results, long long latencyNs) {
+    long long filled = 0;
+    long long trades = 0;
+    for (const ExecutionResults& exec : results) {
+        filled += exec.filled;
+        trades += exec.trades;
+    }
+    Writer w(out);
+    w << "{\"status\":\"ok\",\"orders\":" << results.size() << ",\"filled\":" << filled << ",\"trades\":" << trades
+      << ",\"latency_ns\":" << latencyNs << ",\"results\":[";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const ExecutionResults& exec = results[i];
+        char buf[192];
+        char* p = buf;
+        if (i) *p++ = ',';
+        if (exec.rejected) {
+            p = put(p, "{\"error\":\"price too far from the book\"}");
+        } else {
+            *p++ = '{';
+            if (exec.id) p = put(putInt(put(p, "\"id\":"), exec.id), ",");
+            p = putInt(put(p, "\"filled\":"), exec.filled);
+            p = putInt(put(p, ",\"trades\":"), exec.trades);
+            p = putDouble(put(p, ",\"avg_price\":"), exec.filled > 0 ? exec.notional / static_cast<double>(exec.filled) : 0.0);
+            if (exec.triggered) p = putInt(put(p, ",\"triggered\":"), exec.triggered);
+            *p++ = '}';
+        }
+        w << std::string_view(buf, static_cast<std::size_t>(p - buf));
+    }
+    w << "]}";
+}
+
+void candles(std::string& out, std::int64_t interval, const std::vector<Candle>& bars) {
+    Writer w(out);
+    w << "{\"interval\":" << interval << ",\"candles\":[";
+    for (std::size_t i = 0; i < bars.size(); ++i) {
+        const Candle& bar = bars[i];
+        char buf[320];
+        char* p = buf;
+        if (i) *p++ = ',';
+        p = putInt(put(p, "{\"start\":"), bar.start);
+        p = putDouble(put(p, ",\"open\":"), bar.open);
+        p = putDouble(put(p, ",\"high\":"), bar.high);
+        p = putDouble(put(p, ",\"low\":"), bar.low);
+        p = putDouble(put(p, ",\"close\":"), bar.close);
+        p = putInt(put(p, ",\"volume\":"), bar.volume);
+        p = putDouble(put(p, ",\"vwap\":"), bar.volume > 0 ? bar.notional / static_cast<double>(bar.volume) : 0.0);
+        p = putInt(put(p, ",\"trades\":"), bar.trades);
+        *p++ = '}';
+        w << std::string_view(buf, static_cast<std::size_t>(p - buf));
+    }
+    w << "]}";
+}
+
+namespace {
+
+// One order object, from its '{' to its '}'.
+const char* parseFields(Reader& in, OrderFields& out) {
+    out = OrderFields{};
+    if (!in.eat('{')) return "bad json";
+    unsigned seen = 0;
+    if (in.eat('}')) return nullptr;
+    do {
+        std::string_view key;
+        if (!in.string(key) || !in.eat(':')) return "bad json";
+        Field field = key == "symbol" ? SymbolField
+                    : key == "side"   ? SideField
+                    : key == "type"   ? TypeField
+                    : key == "price"  ? PriceField
+                    : key == "qty"    ? QtyField
+                    : key == "stop_price" ? StopPriceField
+                                      : fieldCount;
+        if (field == fieldCount) return "unknown field";
+        if (seen & (1u << field)) return "duplicate field";
+        seen |= 1u << field;
+
+        std::string_view text;
+        double number = 0.0;
+        switch (field) {
+            case SymbolField:
+                if (!in.string(out.symbol) || out.symbol.empty()) return "bad symbol";
+                break;
+            case SideField:
+                if (!in.string(text)) return "bad side";
+                if (text == "buy" || text == "Buy") out.side = Side::Buy;
+                else if (text == "sell" || text == "Sell") out.side = Side::Sell;
+                else return "bad side";
+                break;
+            case TypeField:
+                if (!in.string(text)) return "bad type";
+                if (text == "limit" || text == "Limit") out.type = OrderType::Limit;
+                else if (text == "market" || text == "Market") out.type = OrderType::Market;
+                else if (text == "stop" || text == "Stop") out.type = OrderType::Stop;
+                else if (text == "stop_limit" || text == "StopLimit") out.type = OrderType::StopLimit;
+                else return "bad type";
+                break;
+            case PriceField:
+                if (!in.number(number) || number <= 0.0 || number > maxPrice) return "bad price";
+                out.price = number;
+                break;
+            case QtyField:
+                if (!in.number(number) || number < 1.0 || number > INT_MAX || number != std::floor(number)) return "bad qty";
+                out.qty = static_cast<int>(number);
+                break;
+            case StopPriceField:
+                if (!in.number(number) || number <= 0.0 || number > maxPrice) return "bad stop_price";
+                out.stopPrice = number;
+                break;
+            case fieldCount:
+                break;
+        }
+    } while (in.eat(','));
+    return in.eat('}') ? nullptr : "bad json";
+}
+
+} // namespace
+
+const char* parseOrder(std::string_view body, OrderFields& out) {
+    Reader in{body.data(), body.data() + body.size()};
+    if (const char* error = parseFields(in, out)) return error;
+    in.skip();
+    return in.p == in.end ? nullptr : "bad json";
+}
+
+const char* incomplete(const OrderFields& order) {
+    if (!order.side || !order.type || !order.qty) return "missing side/type/qty";
+    bool stop = *order.type == OrderType::Stop || *order.type == OrderType::StopLimit;
+    if (!order.price && (*order.type == OrderType::Limit || *order.type == OrderType::StopLimit)) return "missing price for limit order";
+    if (stop && !order.stopPrice) return "missing stop_price for stop order";
+    if (!stop && order.stopPrice) return "stop_price is only for stop orders";
+    return nullptr;
+}
+
+const char* parseBatch(std::string_view body, std::string_view& symbol, std::vector<OrderCommand>& out, std::size_t maxOrders,
+                       std::size_t& at) {
+    out.clear();
+    symbol = {};
+    at = noOrder;
+    Reader in{body.data(), body.data() + body.size()};
+    if (!in.eat('{')) return "bad json";
+    bool seenSymbol = false;
+    bool seenOrders = false;
+    if (!in.eat('}')) {
+        do {
+            std::string_view key;
+            if (!in.string(key) || !in.eat(':')) return "bad json";
+            if (key == "symbol") {
+                if (seenSymbol) return "duplicate field";
+                seenSymbol = true;
+                if (!in.string(symbol) || symbol.empty()) return "bad symbol";
+            } else if (key == "orders") {
+                if (seenOrders) return "duplicate field";
+                seenOrders = true;
+                if (!in.eat('[')) return "bad json";
+                if (in.eat(']')) continue;
+                do {
+                    at = out.size();
+                    if (out.size() == maxOrders) return "too many orders";
+                    OrderFields order;
+                    if (const char* error = parseFields(in, order)) return error;
+                    if (!order.symbol.empty()) return "symbol goes outside orders";
+                    if (const char* error = incomplete(order)) return error;
+                    out.push_back({*order.side, *order.type, order.price.value_or(0.0), *order.qty, order.stopPrice.value_or(0.0)});
+                } while (in.eat(','));
+                at = noOrder;
+                if (!in.eat(']')) return "bad json";
+            } else {
+                return "unknown field";
+            }
+        } while (in.eat(','));
+        if (!in.eat('}')) return "bad json";
+    }
+    in.skip();
+    if (in.p != in.end) return "bad json";
+    return out.empty() ? "no orders" : nullptr;
+}
+
+} // namespace json
@@ -0,0 +1,727 @@
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/websocket.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "binary_protocol.h"
+#include "latency_histogram.h"
+
+// End-to-end load against a running api_server: many keep-alive HTTP (or binary port)
+// connections sending a mix of limits, markets, cancels and book reads, plus optional
+// /stream subscribers. Closed loop by default: each connection keeps --pipeline requests in
+// flight and sends the next one as soon as a reply comes back. With --rate every connection
+// sends on a fixed schedule instead, whether or not the server keeps up, and latency runs
+// from when each request was due, so a stall counts against every request it held up
+// (no coordinated omission). Closed-loop latencies get the same treatment after the fact:
+// a reply slower than the connection's running mean also records the requests it held
+// back. Each thread runs its own io_context and histograms; they're merged at the end.
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+using tcp = asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+using std::cout;
+using std::string;
+using std::vector;
+
+namespace {
+
+enum Kind : std::size_t { Limit, Market, Cancel, Book, kindCount };
+constexpr const char* kindNames[] = {"limit", "market", "cancel", "book"};
+
+struct Options {
+    string host{"127.0.0.1"};
+    unsigned short port{9000};
+    unsigned short binaryPort{9001};
+    bool binary{false};                // drive the binary port instead of HTTP
+    std::size_t connections{16};
+    std::size_t threads{std::max(1u, std::min(4u, std::thread::hardware_concurrency()))};
+    std::size_t pipeline{1};           // requests in flight per connection
+    double rate{0.0};                  // total requests/s across connections; 0: closed loop
+    double seconds{10.0};
+    double warmup{2.0};                // run first, not counted
+    std::size_t symbols{1};
+    std::array<unsigned, kindCount> mix{60, 10, 10, 20}; // percent
+    std::size_t subscribers{0};        // /stream clients
+    std::uint64_t seed{42};
+};
+
+class Rng {
+public:
+    explicit Rng(std::uint64_t seed) : state_(seed) {}
+    std::uint64_t next() {
+        std::uint64_t z = (state_ += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    int uniform(int lo, int hi) { return lo + static_cast<int>(next() % static_cast<std::uint64_t>(hi - lo + 1)); }
+    double unit() { return static_cast<double>(next() >> 11) * 0x1.0p-53; }
+private:
+    std::uint64_t state_;
+};
+
+// One per thread, so recording is plain stores.
+struct Stats {
+    std::array<LatencyHistogram, kindCount> latency;   // from when the request was due
+    LatencyHistogram service;                          // from when it was written, uncorrected
+    std::array<std::uint64_t, kindCount> counts{};
+    std::uint64_t errors{0};          // transport failures and unexpected statuses
+    std::uint64_t misses{0};          // cancels of orders that had already gone
+    std::uint64_t fills{0};           // orders that traded
+    std::uint64_t unfinished{0};      // still owed a reply when the run ended
+    std::uint64_t streamMessages{0};
+    std::uint64_t streamBytes{0};
+
+    void merge(const Stats& other) {
+        for (std::size_t k = 0; k < kindCount; ++k) {
+            latency[k].merge(other.latency[k]);
+            counts[k] += other.counts[k];
+        }
+        service.merge(other.service);
+        errors += other.errors;
+        misses += other.misses;
+        fills += other.fills;
+        unfinished += other.unfinished;
+        streamMessages += other.streamMessages;
+        streamBytes += other.streamBytes;
+    }
+};
+
+// The run's clock: warmup ends at `from`, nothing new is sent from `to`, and connections
+// still waiting at `deadline` give up.
+struct Window {
+    Clock::time_point from;
+    Clock::time_point to;
+    Clock::time_point deadline;
+};
+
+std::uint64_t nsBetween(Clock::time_point a, Clock::time_point b) {
+    return b > a ? static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(b - a).count()) : 0;
+}
+
+// What HTTP and binary connections share: the send schedule, the in-flight bookkeeping,
+// the order mix and recording. Subclasses write requests and call complete() per reply.
+class Client : public std::enable_shared_from_this<Client> {
+public:
+    Client(asio::io_context& ioc, const Options& opt, const Window& window, Stats& stats, std::uint64_t seed)
+        : socket_(ioc), timer_(ioc), opt_(opt), window_(window), stats_(stats), rng_(seed) {
+        if (opt.rate > 0) interval_ = std::chrono::nanoseconds(static_cast<long long>(1e9 * static_cast<double>(opt.connections) / opt.rate));
+    }
+    virtual ~Client() = default;
+
+    bool connect(unsigned short port) {
+        boost::system::error_code ec;
+        socket_.connect(tcp::endpoint(asio::ip::make_address(opt_.host, ec), port), ec);
+        if (ec) {
+            std::cerr << "connect " << opt_.host << ':' << port << ": " << ec.message() << '\n';
+            return false;
+        }
+        socket_.set_option(tcp::no_delay(true), ec);
+        return true;
+    }
+
+    asio::any_io_executor executor() { return socket_.get_executor(); }
+
+    void start() {
+        // Spread the connections' schedules over one interval so they don't all fire at once.
+        next_ = Clock::now() + std::chrono::nanoseconds(static_cast<long long>(rng_.unit() * static_cast<double>(interval_.count())));
+        pump();
+        watchdog();
+    }
+
+protected:
+    struct Pending {
+        Clock::time_point due;
+        Clock::time_point sent;
+        Kind kind;
+    };
+
+    // Writes one request of `kind` (into out_) and returns it, or false if there's nothing
+    // that kind can do yet (a cancel with no id to cancel).
+    virtual bool write(Kind kind) = 0;
+    virtual void flush() = 0;
+    virtual void read() = 0;
+
+    // Sends whatever is due while there's room in the pipeline.
+    void pump() {
+        if (closed_) return;
+        while (inFlight_ < opt_.pipeline) {
+            Clock::time_point now = Clock::now();
+            Clock::time_point due = now;
+            if (interval_.count()) {
+                if (next_ > now) {
+                    armTimer();
+                    break;
+                }
+                due = next_;
+            }
+            if (due >= window_.to) {
+                done_ = true;
+                break;
+            }
+            if (interval_.count()) next_ += interval_;
+            Kind kind = pick();
+            if (!write(kind)) {
+                kind = Limit;
+                write(kind);
+            }
+            sent(due, now, kind);
+        }
+        flush();
+        if (inFlight_ && !reading_) {
+            reading_ = true;
+            read();
+        }
+        if (done_ && inFlight_ == 0) close();
+    }
+
+    Kind pick() {
+        unsigned roll = static_cast<unsigned>(rng_.next() % 100);
+        for (std::size_t k = 0; k < kindCount; ++k) {
+            if (roll < opt_.mix[k]) return static_cast<Kind>(k);
+            roll -= opt_.mix[k];
+        }
+        return Limit;
+    }
+
+    virtual void sent(Clock::time_point due, Clock::time_point now, Kind kind) = 0;
+
+    void complete(const Pending& p, bool ok) {
+        Clock::time_point now = Clock::now();
+        --inFlight_;
+        if (!ok) ++stats_.errors;
+        if (p.due >= window_.from && ok) {
+            std::uint64_t service = nsBetween(p.sent, now);
+            std::uint64_t latency = nsBetween(p.due, now);
+            ++stats_.counts[p.kind];
+            stats_.service.record(service);
+            if (interval_.count()) {
+                stats_.latency[p.kind].record(latency);
+            } else {
+                // Closed loop: the running mean is the pace this connection expects to keep.
+                ++samples_;
+                meanNs_ += (static_cast<double>(service) - meanNs_) / static_cast<double>(samples_);
+                stats_.latency[p.kind].record(latency, samples_ > 100 ? static_cast<std::uint64_t>(meanNs_) : 0);
+            }
+        }
+    }
+
+    void fail() {
+        if (closed_) return;
+        ++stats_.errors;
+        close();
+    }
+
+    void close() {
+        if (closed_) return;
+        closed_ = true;
+        stats_.unfinished += inFlight_;
+        boost::system::error_code ec;
+        timer_.cancel();
+        socket_.close(ec);
+    }
+
+    // A symbol and a price near 100 that crosses now and then.
+    std::size_t pickSymbol() { return opt_.symbols > 1 ? static_cast<std::size_t>(rng_.next() % opt_.symbols) : 0; }
+    bool buy() { return rng_.next() & 1; }
+    double limitPrice(bool buy) {
+        double offset = (rng_.unit() - 0.3) * 2.0; // mostly passive
+        return std::round((buy ? 100.0 - offset : 100.0 + offset) * 100.0) / 100.0;
+    }
+    int qty() { return rng_.uniform(1, 10); }
+
+    // Recent resting ids to cancel, per symbol slot; 0 is empty.
+    void remember(std::size_t symbol, std::uint64_t id) {
+        if (id) ids_[(idCount_++) % ids_.size()] = {symbol, id};
+    }
+    bool takeId(std::size_t& symbol, std::uint64_t& id) {
+        for (std::size_t tries = 0; tries < 4 && idCount_; ++tries) {
+            auto& slot = ids_[rng_.next() % std::min(idCount_, ids_.size())];
+            if (slot.second) {
+                symbol = slot.first;
+                id = slot.second;
+                slot.second = 0;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    tcp::socket socket_;
+    asio::steady_timer timer_;
+    const Options& opt_;
+    const Window& window_;
+    Stats& stats_;
+    Rng rng_;
+    std::size_t inFlight_{0};
+    bool reading_{false};
+    bool closed_{false};
+    bool done_{false};
+
+private:
+    void armTimer() {
+        if (timerArmed_) return;
+        timerArmed_ = true;
+        timer_.expires_at(next_);
+        timer_.async_wait([self = shared_from_this()](boost::system::error_code ec) {
+            self->timerArmed_ = false;
+            if (!ec) self->pump();
+        });
+    }
+
+    // Gives up on whatever is still out once the run's deadline passes.
+    void watchdog() {
+        auto guard = std::make_shared<asio::steady_timer>(socket_.get_executor(), window_.deadline);
+        guard->async_wait([self = shared_from_this(), guard](boost::system::error_code) { self->close(); });
+    }
+
+    std::chrono::nanoseconds interval_{0};
+    Clock::time_point next_;
+    bool timerArmed_{false};
+    std::uint64_t samples_{0};
+    double meanNs_{0.0};
+    std::array<std::pair<std::size_t, std::uint64_t>, 256> ids_{};
+    std::size_t idCount_{0};
+};
+
+// Keep-alive HTTP/1.1, pipelined up to --pipeline. Requests are formatted by hand into one
+// buffer, which goes out in a single write; replies come back in order.
+class HttpClient : public Client {
+public:
+    using Client::Client;
+
+private:
+    struct Request {
+        Pending pending;
+        std::size_t symbol;
+    };
+
+    bool write(Kind kind) override {
+        std::size_t symbol = pickSymbol();
+        char body[160];
+        int len = 0;
+        switch (kind) {
+            case Limit:
+            case Market: {
+                bool b = buy();
+                if (kind == Limit) {
+                    len = std::snprintf(body, sizeof(body), "{\"symbol\":\"LG%zu\",\"side\":\"%s\",\"type\":\"limit\",\"price\":%.2f,\"qty\":%d}",
+                                        symbol, b ? "buy" : "sell", limitPrice(b), qty());
+                } else {
+                    len = std::snprintf(body, sizeof(body), "{\"symbol\":\"LG%zu\",\"side\":\"%s\",\"type\":\"market\",\"qty\":%d}", symbol,
+                                        b ? "buy" : "sell", qty());
+                }
+                char head[128];
+                int headLen = std::snprintf(head, sizeof(head),
+                                            "POST /orders HTTP/1.1\r\nHost: loadgen\r\nContent-Type: application/json\r\nContent-Length: %d\r\n\r\n", len);
+                out_.append(head, static_cast<std::size_t>(headLen)).append(body, static_cast<std::size_t>(len));
+                break;
+            }
+            case Cancel: {
+                std::uint64_t id = 0;
+                if (!takeId(symbol, id)) return false;
+                char head[128];
+                int headLen = std::snprintf(head, sizeof(head), "DELETE /orders/%llu?symbol=LG%zu HTTP/1.1\r\nHost: loadgen\r\n\r\n",
+                                            static_cast<unsigned long long>(id), symbol);
+                out_.append(head, static_cast<std::size_t>(headLen));
+                break;
+            }
+            case Book: {
+                char head[128];
+                int headLen = std::snprintf(head, sizeof(head), "GET /book?symbol=LG%zu&depth=10 HTTP/1.1\r\nHost: loadgen\r\n\r\n", symbol);
+                out_.append(head, static_cast<std::size_t>(headLen));
+                break;
+            }
+            case kindCount:
+                return false;
+        }
+        lastSymbol_ = symbol;
+        return true;
+    }
+
+    void sent(Clock::time_point due, Clock::time_point now, Kind kind) override {
+        queue_[(head_ + inFlight_) % queue_.size()] = Request{{due, now, kind}, lastSymbol_};
+        ++inFlight_;
+    }
+
+    void flush() override {
+        if (writing_ || out_.empty() || closed_) return;
+        writing_ = true;
+        wire_.swap(out_);
+        asio::async_write(socket_, asio::buffer(wire_), [self = shared(), this](boost::system::error_code ec, std::size_t) {
+            writing_ = false;
+            wire_.clear();
+            if (ec) return fail();
+            flush();
+        });
+    }
+
+    void read() override {
+        res_ = {};
+        http::async_read(socket_, buffer_, res_, [self = shared(), this](boost::system::error_code ec, std::size_t) {
+            reading_ = false;
+            if (ec) return fail();
+            const Request& r = queue_[head_];
+            head_ = (head_ + 1) % queue_.size();
+            unsigned status = res_.result_int();
+            bool ok = status == 200;
+            if (r.pending.kind == Cancel && status == 404) {
+                ++stats_.misses;
+                ok = true;
+            }
+            if (ok && (r.pending.kind == Limit || r.pending.kind == Market)) {
+                const string& body = res_.body();
+                std::uint64_t id = field(body, "\"id\":");
+                std::uint64_t filled = field(body, "\"filled\":");
+                if (filled) ++stats_.fills;
+                // Only what's still resting is worth cancelling.
+                if (r.pending.kind == Limit && filled < field(body, "\"requested\":")) remember(r.symbol, id);
+            }
+            complete(r.pending, ok);
+            pump();
+        });
+    }
+
+    static std::uint64_t field(const string& body, const char* key) {
+        auto at = body.find(key);
+        std::uint64_t value = 0;
+        if (at != string::npos) std::from_chars(body.data() + at + std::strlen(key), body.data() + body.size(), value);
+        return value;
+    }
+
+    std::shared_ptr<HttpClient> shared() { return std::static_pointer_cast<HttpClient>(shared_from_this()); }
+
+    string out_;
+    string wire_;
+    bool writing_{false};
+    beast::flat_buffer buffer_;
+    http::response<http::string_body> res_;
+    std::array<Request, 256> queue_{};
+    std::size_t head_{0};
+    std::size_t lastSymbol_{0};
+};
+
+// The fixed-layout binary port. There's no book read, so those go out as limits. Replies
+// can come back out of order (symbols on different shards), so they're matched by seq.
+class BinaryClient : public Client {
+public:
+    using Client::Client;
+
+private:
+    struct Request {
+        Pending pending;
+        std::size_t symbol;
+        bool live{false};
+    };
+
+    template <typename Msg>
+    void put(Msg& msg, wire::MsgType type, std::size_t symbol) {
+        msg.header = wire::MsgHeader{static_cast<std::uint16_t>(sizeof(Msg)), type, wire::version, ++seq_};
+        std::snprintf(msg.symbol, sizeof(msg.symbol), "LG%u", static_cast<unsigned>(symbol));
+        out_.append(reinterpret_cast<const char*>(&msg), sizeof(msg));
+    }
+
+    bool write(Kind kind) override {
+        std::size_t symbol = pickSymbol();
+        if (kind == Cancel) {
+            std::uint64_t id = 0;
+            if (!takeId(symbol, id)) return false;
+            wire::CancelMsg msg{};
+            msg.orderId = id;
+            put(msg, wire::Cancel, symbol);
+        } else {
+            bool b = buy();
+            wire::NewOrderMsg msg{};
+            msg.qty = qty();
+            msg.side = b ? 0 : 1;
+            msg.orderType = kind == Market ? 1 : 0;
+            if (kind != Market) msg.price = std::llround(limitPrice(b) * static_cast<double>(wire::priceScale));
+            put(msg, wire::NewOrder, symbol);
+        }
+        lastSymbol_ = symbol;
+        return true;
+    }
+
+    void sent(Clock::time_point due, Clock::time_point now, Kind kind) override {
+        pending_[seq_ % pending_.size()] = Request{{due, now, kind == Book ? Limit : kind}, lastSymbol_, true};
+        ++inFlight_;
+    }
+
+    void flush() override {
+        if (writing_ || out_.empty() || closed_) return;
+        writing_ = true;
+        wire_.swap(out_);
+        asio::async_write(socket_, asio::buffer(wire_), [self = shared(), this](boost::system::error_code ec, std::size_t) {
+            writing_ = false;
+            wire_.clear();
+            if (ec) return fail();
+            flush();
+        });
+    }
+
+    void read() override {
+        socket_.async_read_some(asio::buffer(in_.data() + end_, in_.size() - end_), [self = shared(), this](boost::system::error_code ec, std::size_t n) {
+            reading_ = false;
+            if (ec) return fail();
+            end_ += n;
+            std::size_t at = 0;
+            while (end_ - at >= sizeof(wire::MsgHeader)) {
+                wire::MsgHeader header;
+                std::memcpy(&header, in_.data() + at, sizeof(header));
+                if (header.length < sizeof(header) || header.length > wire::maxMessage) return fail();
+                if (end_ - at < header.length) break;
+                handle(in_.data() + at, header);
+                at += header.length;
+            }
+            std::memmove(in_.data(), in_.data() + at, end_ - at);
+            end_ -= at;
+            pump();
+        });
+    }
+
+    void handle(const char* p, const wire::MsgHeader& header) {
+        std::uint32_t requestSeq = 0;
+        std::memcpy(&requestSeq, p + sizeof(header), sizeof(requestSeq));
+        if (header.type == wire::Fill) {
+            ++stats_.fills;
+            return;
+        }
+        Request& r = pending_[requestSeq % pending_.size()];
+        if (!r.live) return;
+        r.live = false;
+        bool ok = true;
+        if (header.type == wire::Ack) {
+            wire::AckMsg ack;
+            std::memcpy(&ack, p, sizeof(ack));
+            if (ack.kind == wire::Accepted) remember(r.symbol, ack.orderId);
+        } else if (header.type == wire::Reject) {
+            wire::RejectMsg reject;
+            std::memcpy(&reject, p, sizeof(reject));
+            if (reject.reason == wire::UnknownOrder) ++stats_.misses;
+            else ok = false;
+        }
+        complete(r.pending, ok);
+    }
+
+    std::shared_ptr<BinaryClient> shared() { return std::static_pointer_cast<BinaryClient>(shared_from_this()); }
+
+    string out_;
+    string wire_;
+    bool writing_{false};
+    std::array<char, 1 << 16> in_{};
+    std::size_t end_{0};
+    std::uint32_t seq_{0};
+    std::array<Request, 1024> pending_{};
+    std::size_t lastSymbol_{0};
+};
+
+// A /stream WebSocket that just counts what it's sent during the measured window.
+class Subscriber : public std::enable_shared_from_this<Subscriber> {
+public:
+    Subscriber(asio::io_context& ioc, const Window& window, Stats& stats) : ws_(ioc), window_(window), stats_(stats) {}
+
+    bool connect(const Options& opt, std::size_t symbol) {
+        boost::system::error_code ec;
+        ws_.next_layer().connect(tcp::endpoint(asio::ip::make_address(opt.host, ec), opt.port), ec);
+        if (!ec) ws_.handshake(opt.host, "/stream?symbol=LG" + std::to_string(symbol), ec);
+        if (ec) {
+            std::cerr << "stream: " << ec.message() << '\n';
+            return false;
+        }
+        return true;
+    }
+
+    void start() {
+        auto guard = std::make_shared<asio::steady_timer>(ws_.get_executor(), window_.to);
+        guard->async_wait([self = shared_from_this(), guard](boost::system::error_code) {
+            boost::system::error_code ec;
+            self->ws_.next_layer().close(ec);
+        });
+        read();
+    }
+
+private:
+    void read() {
+        ws_.async_read(buffer_, [self = shared_from_this()](boost::system::error_code ec, std::size_t n) {
+            if (ec) return;
+            Clock::time_point now = Clock::now();
+            if (now >= self->window_.from && now < self->window_.to) {
+                ++self->stats_.streamMessages;
+                self->stats_.streamBytes += n;
+            }
+            self->buffer_.consume(self->buffer_.size());
+            self->read();
+        });
+    }
+
+    beast::websocket::stream<tcp::socket> ws_;
+    beast::flat_buffer buffer_;
+    const Window& window_;
+    Stats& stats_;
+};
+
+void usage() {
+    cout << "orderbook_loadgen [--host 127.0.0.1] [--port 9000] [--binary [--binary-port 9001]]\n"
+            "                  [--connections 16] [--threads N] [--pipeline 1] [--rate req/s]\n"
+            "                  [--seconds 10] [--warmup 2] [--symbols 1] [--subscribers 0]\n"
+            "                  [--mix limit=60,market=10,cancel=10,book=20] [--seed N]\n";
+}
+
+vector<string> split(const string& s, char sep) {
+    vector<string> out;
+    std::stringstream ss(s);
+    string item;
+    while (std::getline(ss, item, sep)) out.push_back(item);
+    return out;
+}
+
+bool parseMix(const string& text, std::array<unsigned, kindCount>& mix) {
+    mix.fill(0);
+    unsigned total = 0;
+    for (const auto& part : split(text, ',')) {
+        auto eq = part.find('=');
+        if (eq == string::npos) return false;
+        string name = part.substr(0, eq);
+        auto it = std::find_if(std::begin(kindNames), std::end(kindNames), [&](const char* k) { return name == k; });
+        if (it == std::end(kindNames)) return false;
+        unsigned pct = static_cast<unsigned>(std::stoul(part.substr(eq + 1)));
+        mix[static_cast<std::size_t>(it - std::begin(kindNames))] = pct;
+        total += pct;
+    }
+    return total == 100;
+}
+
+bool parseArgs(int argc, char** argv, Options& opt) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--binary") {
+            opt.binary = true;
+            continue;
+        }
+        if (arg == "-h" || arg == "--help" || i + 1 >= argc) return false;
+        string val = argv[++i];
+        if (arg == "--host") opt.host = val;
+        else if (arg == "--port") opt.port = static_cast<unsigned short>(std::stoul(val));
+        else if (arg == "--binary-port") opt.binaryPort = static_cast<unsigned short>(std::stoul(val));
+        else if (arg == "--connections") opt.connections = std::max<std::size_t>(1, std::stoull(val));
+        else if (arg == "--threads") opt.threads = std::max<std::size_t>(1, std::stoull(val));
+        else if (arg == "--pipeline") opt.pipeline = std::clamp<std::size_t>(std::stoull(val), 1, 256);
+        else if (arg == "--rate") opt.rate = std::stod(val);
+        else if (arg == "--seconds") opt.seconds = std::stod(val);
+        else if (arg == "--warmup") opt.warmup = std::stod(val);
+        else if (arg == "--symbols") opt.symbols = std::max<std::size_t>(1, std::stoull(val));
+        else if (arg == "--subscribers") opt.subscribers = std::stoull(val);
+        else if (arg == "--seed") opt.seed = std::stoull(val);
+        else if (arg == "--mix") {
+            if (!parseMix(val, opt.mix)) return false;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+void printRow(const char* name, const LatencyHistogram& h) {
+    auto us = [](std::uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+    cout << std::left << std::setw(9) << name << std::right << std::setw(10) << h.count() << std::setw(10) << us(h.percentile(0.5))
+         << std::setw(10) << us(h.percentile(0.9)) << std::setw(10) << us(h.percentile(0.99)) << std::setw(10) << us(h.percentile(0.999))
+         << std::setw(10) << us(h.percentile(0.9999)) << std::setw(11) << us(h.max()) << '\n';
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parseArgs(argc, argv, opt)) {
+        usage();
+        return 2;
+    }
+    opt.threads = std::min(opt.threads, opt.connections + opt.subscribers);
+
+    Window window;
+    vector<std::unique_ptr<asio::io_context>> contexts;
+    vector<std::unique_ptr<Stats>> stats;
+    for (std::size_t t = 0; t < opt.threads; ++t) {
+        contexts.push_back(std::make_unique<asio::io_context>(1));
+        stats.push_back(std::make_unique<Stats>());
+    }
+
+    // Connect everything up front so the handshakes stay out of the numbers.
+    vector<std::shared_ptr<Client>> clients;
+    for (std::size_t c = 0; c < opt.connections; ++c) {
+        std::size_t t = c % opt.threads;
+        std::shared_ptr<Client> client;
+        if (opt.binary) client = std::make_shared<BinaryClient>(*contexts[t], opt, window, *stats[t], opt.seed + c);
+        else client = std::make_shared<HttpClient>(*contexts[t], opt, window, *stats[t], opt.seed + c);
+        if (!client->connect(opt.binary ? opt.binaryPort : opt.port)) return 1;
+        clients.push_back(std::move(client));
+    }
+    vector<std::shared_ptr<Subscriber>> subscribers;
+    for (std::size_t s = 0; s < opt.subscribers; ++s) {
+        std::size_t t = s % opt.threads;
+        auto sub = std::make_shared<Subscriber>(*contexts[t], window, *stats[t]);
+        if (!sub->connect(opt, s % opt.symbols)) return 1;
+        subscribers.push_back(std::move(sub));
+    }
+
+    auto start = Clock::now();
+    window.from = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opt.warmup));
+    window.to = window.from + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opt.seconds));
+    window.deadline = window.to + std::chrono::seconds(2);
+    for (auto& client : clients) asio::post(client->executor(), [client] { client->start(); });
+    for (auto& sub : subscribers) sub->start();
+    clients.clear();
+    subscribers.clear();
+
+    vector<std::thread> threads;
+    for (auto& ioc : contexts) threads.emplace_back([&ioc] { ioc->run(); });
+    for (auto& thread : threads) thread.join();
+
+    Stats total;
+    for (const auto& s : stats) total.merge(*s);
+    LatencyHistogram all;
+    std::uint64_t requests = 0;
+    for (std::size_t k = 0; k < kindCount; ++k) {
+        all.merge(total.latency[k]);
+        requests += total.counts[k];
+    }
+
+    cout << (opt.binary ? "binary" : "http") << ", " << (opt.rate > 0 ? "open loop at " + std::to_string(static_cast<long long>(opt.rate)) + " req/s" : "closed loop")
+         << ", " << opt.connections << " connections x " << opt.pipeline << " in flight, " << opt.threads << " threads, " << opt.seconds
+         << " s after " << opt.warmup << " s warmup\n";
+    cout << std::fixed << std::setprecision(1);
+    cout << "requests " << requests << " (" << static_cast<double>(requests) / opt.seconds << "/s), traded " << total.fills << ", cancel misses "
+         << total.misses << ", errors " << total.errors << ", unfinished " << total.unfinished << '\n';
+    if (opt.subscribers) {
+        cout << "stream   " << opt.subscribers << " subscribers, " << static_cast<double>(total.streamMessages) / opt.seconds << " msg/s, "
+             << static_cast<double>(total.streamBytes) / opt.seconds / 1e6 << " MB/s\n";
+    }
+    cout << "\nlatency (us)" << (opt.rate > 0 ? ", from when each request was due" : ", corrected for coordinated omission") << '\n';
+    cout << std::left << std::setw(9) << "" << std::right << std::setw(10) << "count" << std::setw(10) << "p50" << std::setw(10) << "p90"
+         << std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::setw(10) << "p99.99" << std::setw(11) << "max" << '\n';
+    for (std::size_t k = 0; k < kindCount; ++k) {
+        if (total.latency[k].count()) printRow(kindNames[k], total.latency[k]);
+    }
+    printRow("all", all);
+    printRow("service", total.service);
+    cout << "(service: written to answered, uncorrected)\n";
+    return total.errors ? 1 : 0;
+}
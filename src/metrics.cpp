@@ -0,0 +1,105 @@
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "metrics.h"
+
+namespace metrics {
+
+namespace {
+
+std::mutex registryMutex;
+std::vector<std::unique_ptr<ThreadBlock>> registry;
+
+const char* const stageNames[stageCount] = {"parse", "queue", "match", "serialize", "write", "request"};
+
+// Buckets exported as `le` bounds: 64 ns up to ~1.07 s. Samples outside fall into the
+// first bound or +Inf.
+constexpr std::size_t firstBucket = 6;
+constexpr std::size_t lastBucket = 30;
+
+} // namespace
+
+// 5 ms of spinning at startup; a plain global so the hot path doesn't check an init guard.
+const double nsPerTick = [] {
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    std::uint64_t t0 = ticks();
+    while (clock::now() - start < std::chrono::milliseconds(5)) {
+    }
+    std::uint64_t t1 = ticks();
+    double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    return t1 > t0 ? ns / static_cast<double>(t1 - t0) : 1.0;
+}();
+
+ThreadBlock& registerThread() {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    registry.push_back(std::make_unique<ThreadBlock>());
+    return *registry.back();
+}
+
+std::string render() {
+    std::array<std::array<std::uint64_t, StageHistogram::buckets>, stageCount> hist{};
+    std::array<std::uint64_t, stageCount> sums{};
+    std::array<std::uint64_t, counterCount> counters{};
+    std::array<std::uint64_t, gaugeCount> gauges{};
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (const auto& block : registry) {
+            for (std::size_t s = 0; s < stageCount; ++s) {
+                for (std::size_t b = 0; b < StageHistogram::buckets; ++b) hist[s][b] += block->stages[s].counts[b].get();
+                sums[s] += block->stages[s].sumNs.get();
+            }
+            for (std::size_t c = 0; c < counterCount; ++c) counters[c] += block->counters[c].get();
+            for (std::size_t g = 0; g < gaugeCount; ++g) gauges[g] += block->gauges[g].get(); // wraps back to the signed total
+        }
+    }
+
+    std::ostringstream out;
+    out << "# HELP orderbook_stage_seconds Time spent in each stage of a request.\n"
+           "# TYPE orderbook_stage_seconds histogram\n";
+    for (std::size_t s = 0; s < stageCount; ++s) {
+        std::uint64_t cumulative = 0;
+        for (std::size_t b = 0; b < StageHistogram::buckets; ++b) {
+            cumulative += hist[s][b];
+            if (b < firstBucket || b > lastBucket) continue;
+            out << "orderbook_stage_seconds_bucket{stage=\"" << stageNames[s] << "\",le=\""
+                << static_cast<double>(std::uint64_t{1} << b) * 1e-9 << "\"} " << cumulative << '\n';
+        }
+        out << "orderbook_stage_seconds_bucket{stage=\"" << stageNames[s] << "\",le=\"+Inf\"} " << cumulative << '\n';
+        out << "orderbook_stage_seconds_sum{stage=\"" << stageNames[s] << "\"} " << static_cast<double>(sums[s]) * 1e-9 << '\n';
+        out << "orderbook_stage_seconds_count{stage=\"" << stageNames[s] << "\"} " << cumulative << '\n';
+    }
+
+    out << "# HELP orderbook_commands_total Commands run by the matching threads. Orders in a batch count as limits, markets and stops too.\n"
+           "# TYPE orderbook_commands_total counter\n";
+    const std::pair<Counter, const char*> kinds[] = {{LimitOrders, "limit"}, {MarketOrders, "market"}, {Cancels, "cancel"},
+                                                     {Modifies, "modify"},   {BookReads, "book"},      {Stimmies, "stimmy"},
+                                                     {Clears, "clear"},      {Batches, "batch"},
+                                                     {Stops, "stop"},        {CandleReads, "candles"}};
+    for (const auto& [counter, name] : kinds) out << "orderbook_commands_total{kind=\"" << name << "\"} " << counters[counter] << '\n';
+
+    auto counter = [&out](const char* name, const char* help, std::uint64_t value) {
+        out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << " counter\n" << name << ' ' << value << '\n';
+    };
+    auto gauge = [&out](const char* name, const char* help, std::uint64_t value) {
+        out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << " gauge\n"
+            << name << ' ' << static_cast<std::int64_t>(value) << '\n';
+    };
+    counter("orderbook_fills_total", "Executions against resting orders.", counters[Fills]);
+    counter("orderbook_filled_quantity_total", "Quantity traded.", counters[FilledQty]);
+    counter("orderbook_rejected_total", "Limit orders and modifies rejected for being too far from the book.", counters[Rejected]);
+    counter("orderbook_stops_triggered_total", "Stop and stop-limit orders set off by a trade.", counters[StopsTriggered]);
+    counter("orderbook_http_requests_total", "HTTP requests handled.", counters[HttpRequests]);
+    counter("orderbook_heap_growths_total", "Times a book's order path had to allocate (pool, index or ladder growth).",
+            counters[HeapGrowths]);
+    gauge("orderbook_books", "Books that exist.", gauges[Books]);
+    gauge("orderbook_resting_orders", "Orders resting across every book.", gauges[RestingOrders]);
+    gauge("orderbook_pending_stops", "Stops waiting for their price across every book.", gauges[PendingStops]);
+    gauge("orderbook_price_levels", "Occupied price levels across every book.", gauges[PriceLevels]);
+    gauge("orderbook_http_connections", "Open HTTP connections.", gauges[HttpConnections]);
+    return out.str();
+}
+
+} // namespace metrics
@@ -1,39 +1,291 @@
-
 #include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
 #include <vector>
-#include <deque>
+#include "fill_listener.h"
 #include "orderbook.h"
 
 using std::vector;
 using std::cout;
-using std::deque;
 using namespace ansi;
 
 
-void orderbook::printBook() {
+template <typename PriceT, typename QtyT, typename Listener>
+basic_orderbook<PriceT, QtyT, Listener>::basic_orderbook(const BookConfig& config, Listener listener)
+    : ticksPerUnit_(1.0 / config.tickSize),
+      tick_(std::llround(config.tickSize)),
+      maxLadderTicks_(std::max<std::size_t>(config.maxLadderTicks, 64)),
+      listener_(std::move(listener)) {
+    if (!(config.tickSize > 0.0)) throw std::invalid_argument("tick size must be positive");
+    if (fixedPoint && (tick_ < 1 || static_cast<double>(tick_) != config.tickSize)) {
+        throw std::invalid_argument("tick size must be a whole number of price units for integer prices");
+    }
+    std::size_t ticks = std::clamp<std::size_t>(config.ladderTicks, 64, maxLadderTicks_);
+    ladder_.resize(ticks);
+    bidLevels_.resize(ticks);
+    askLevels_.resize(ticks);
+    reserve(config.reserveOrders);
+}
+
+// Slots are created and threaded onto the free list here, so their pages are already
+// faulted in by the time the matching path hands them out.
+template <typename PriceT, typename QtyT, typename Listener>
+void basic_orderbook<PriceT, QtyT, Listener>::reserve(std::size_t orders) {
+    std::size_t have = nodes_.size();
+    if (orders > have) {
+        nodes_.resize(orders);
+        for (std::size_t slot = orders; slot-- > have;) releaseSlot(static_cast<std::uint32_t>(slot));
+    }
+    index_.reserve(orders);
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+void basic_orderbook<PriceT, QtyT, Listener>::clear() {
+    ++version_;
+    if (capture_) { // every resting level is about to vanish
+        for (std::size_t i = bidLevels_.next(0); i != npos; i = bidLevels_.next(i + 1)) touch(Side::Buy, baseTick_ + static_cast<std::int64_t>(i));
+        for (std::size_t i = askLevels_.next(0); i != npos; i = askLevels_.next(i + 1)) touch(Side::Sell, baseTick_ + static_cast<std::int64_t>(i));
+    }
+    std::fill(ladder_.begin(), ladder_.end(), PriceLevel{});
+    bidLevels_.reset();
+    askLevels_.reset();
+    bestBid_ = npos;
+    bestAsk_ = npos;
+    freeSlot_ = nil;
+    levels_ = 0;
+    for (std::size_t slot = nodes_.size(); slot-- > 0;) releaseSlot(static_cast<std::uint32_t>(slot));
+    index_.clear();
+    buyStops_.clear();
+    sellStops_.clear();
+    stopCount_ = 0;
+    tradeLow_ = std::numeric_limits<std::int64_t>::max();
+    tradeHigh_ = std::numeric_limits<std::int64_t>::min();
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+std::int64_t basic_orderbook<PriceT, QtyT, Listener>::toTick(PriceT price) const {
+    if constexpr (fixedPoint) { // nearest tick, halves up, exact for any 64-bit price
+        std::int64_t p = static_cast<std::int64_t>(price);
+        std::int64_t q = p / tick_;
+        std::int64_t r = p % tick_;
+        if (r < 0) {
+            --q;
+            r += tick_;
+        }
+        q = r * 2 >= tick_ ? q + 1 : q;
+        return std::clamp(q, -maxTick - 1, maxTick + 1);
+    } else {
+        double t = price * ticksPerUnit_;
+        if (!(std::abs(t) <= static_cast<double>(maxTick))) return t > 0 ? maxTick + 1 : -maxTick - 1; // NaN too
+        return std::llround(t);
+    }
+}
+
+// Make sure every tick from lo to hi has a slot on the ladder, recentring or growing it if
+// needed. Returns false when the book would have to span more than maxLadderTicks_, or a
+// tick is out past maxTick.
+template <typename PriceT, typename QtyT, typename Listener>
+bool basic_orderbook<PriceT, QtyT, Listener>::fitTicks(std::int64_t lo, std::int64_t hi) {
+    if (!tickOk(lo) || !tickOk(hi)) return false;
+    std::int64_t size = static_cast<std::int64_t>(ladder_.size());
+    if (lo >= baseTick_ && hi < baseTick_ + size) return true;
+
+    std::int64_t low = lo;
+    std::int64_t high = hi;
+    if (bestBid_ == npos && bestAsk_ == npos) { // nothing resting: just slide the window over
+        if (high - low < size) {
+            baseTick_ = low - (size - (high - low)) / 2;
+            return true;
+        }
+    } else {
+        std::size_t lowIdx = bestBid_ != npos ? bidLevels_.next(0) : bestAsk_;
+        std::size_t highIdx = bestAsk_ != npos ? askLevels_.prev(ladder_.size() - 1) : bestBid_;
+        low = std::min(low, baseTick_ + static_cast<std::int64_t>(lowIdx));
+        high = std::max(high, baseTick_ + static_cast<std::int64_t>(highIdx));
+    }
+    std::size_t span = static_cast<std::size_t>(high - low + 1);
+    if (span > maxLadderTicks_) return false;
+    ++growths_;
+
+    std::size_t newSize = ladder_.size();
+    while (newSize < span * 2 && newSize < maxLadderTicks_) newSize *= 2;
+    newSize = std::min(newSize, maxLadderTicks_);
+    std::int64_t newBase = low - static_cast<std::int64_t>((newSize - span) / 2);
+
+    vector<PriceLevel> grown(newSize);
+    LevelBitmap bids(newSize);
+    LevelBitmap asks(newSize);
+    std::size_t shift = static_cast<std::size_t>(baseTick_ - newBase);
+    for (std::size_t i = 0; i < ladder_.size(); ++i) {
+        if (ladder_[i].empty()) continue;
+        grown[i + shift] = std::move(ladder_[i]);
+        if (bidLevels_.test(i)) bids.set(i + shift);
+        else asks.set(i + shift);
+    }
+    ladder_ = std::move(grown);
+    bidLevels_ = std::move(bids);
+    askLevels_ = std::move(asks);
+    if (bestBid_ != npos) bestBid_ += shift;
+    if (bestAsk_ != npos) bestAsk_ += shift;
+    baseTick_ = newBase;
+    return true;
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+void basic_orderbook<PriceT, QtyT, Listener>::printBook() {
     cout << "Price | Quantity \n";
     cout << "Asks: \n";
 
-    for (auto it = sells_.rbegin(); it != sells_.rend(); ++it) { // display asks high -> low
-        const auto& pair = *it;
-        int qty = 0;
-        for (const auto& p : pair.second) qty += p.quantity;
-        cout << red << pair.first << " | " << qty << reset << '\n';
+    if (bestAsk_ != npos) { // display asks high -> low
+        for (std::size_t i = askLevels_.prev(ladder_.size() - 1); i != npos && i >= bestAsk_; i = i ? askLevels_.prev(i - 1) : npos) {
+            cout << red << toPrice(i) << " | " << ladder_[i].quantity << reset << '\n';
+        }
     }
 
     cout << "--------------------\n";
     cout << "Bids: \n";
-    
-    for (const auto& pair : buys_) {
-        int qty = 0;
-        for (const auto& p : pair.second) qty += p.quantity;
-        cout << green <<  pair.first << " | " << qty << reset << '\n';
+
+    for (std::size_t i = bestBid_; i != npos; i = i ? bidLevels_.prev(i - 1) : npos) {
+        cout << green << toPrice(i) << " | " << ladder_[i].quantity << reset << '\n';
+    }
+}
+
+// Walk the opposite side from the touch, filling `quantity` until it runs out or the
+// next level is past limitIdx. Filled makers are unlinked, which also moves the touch on.
+// Each fill goes to the listener before its maker can be released, and the range of ticks
+// that traded is kept for the stops. The side is a template
+// argument, so which half of the book, the price comparison and the maker side are all
+// fixed at compile time; a market order is the same loop with the price check compiled out.
+template <typename PriceT, typename QtyT, typename Listener>
+template <Side Taker, bool Market>
+void basic_orderbook<PriceT, QtyT, Listener>::sweep(OrderId takerId, QtyT& quantity, std::size_t limitIdx, ExecutionResults& results) {
+    constexpr bool buying = Taker == Side::Buy;
+    constexpr Side makerSide = buying ? Side::Sell : Side::Buy;
+    const std::size_t& best = buying ? bestAsk_ : bestBid_;
+    const std::size_t first = best;
+    std::size_t last = npos;
+
+    while (quantity > 0 && best != npos) {
+        if constexpr (!Market) {
+            if (buying ? best > limitIdx : best < limitIdx) break;
+        }
+        last = best;
+        PriceLevel& level = ladder_[best];
+        std::uint32_t slot = level.head;
+        Order& maker = nodes_[slot].order;
+        QtyT tradeQty = std::min(quantity, maker.quantity);
+        results.traded |= tradeQty > 0;
+        results.filled += tradeQty;
+        results.trades += tradeQty > 0 ? 1 : 0;
+        results.notional += static_cast<double>(tradeQty) * static_cast<double>(maker.price);
+        quantity -= tradeQty;
+        maker.quantity -= tradeQty;
+        level.quantity -= tradeQty;
+        touch(makerSide, nodes_[slot].tick); // the maker's level changed, captured or not
+        if (capture_) trades_.push_back({maker.price, tradeQty, Taker});
+        if constexpr (reportsFills) listener_.onFill(Fill{maker.id, takerId, maker.price, tradeQty, Taker, ++fillSeq_});
+        if (maker.quantity == 0) {
+            index_.erase(maker.id);
+            unlink<makerSide>(slot);
+            releaseSlot(slot);
+        }
+    }
+    if (last != npos) { // a buy walks up from first, a sell down
+        tradeLow_ = std::min(tradeLow_, baseTick_ + static_cast<std::int64_t>(buying ? first : last));
+        tradeHigh_ = std::max(tradeHigh_, baseTick_ + static_cast<std::int64_t>(buying ? last : first));
+    }
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+std::uint32_t basic_orderbook<PriceT, QtyT, Listener>::takeSlot() {
+    std::uint32_t slot = freeSlot_;
+    if (slot != nil) {
+        freeSlot_ = nodes_[slot].next;
+        return slot;
+    }
+    ++growths_; // pool exhausted: grow past the reservation
+    nodes_.emplace_back();
+    return static_cast<std::uint32_t>(nodes_.size() - 1);
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+void basic_orderbook<PriceT, QtyT, Listener>::rest(std::int64_t tick, const Order& o) {
+    std::uint32_t slot = takeSlot();
+    std::size_t idx = static_cast<std::size_t>(tick - baseTick_);
+    PriceLevel& level = ladder_[idx];
+    nodes_[slot] = OrderNode{o, tick, level.tail, nil};
+    if (level.tail != nil) {
+        nodes_[level.tail].next = slot;
+    } else {
+        level.head = slot;
+        ++levels_;
     }
+    level.tail = slot;
+    level.quantity += o.quantity;
+    ++level.orders;
+    index_.insert(o.id, slot);
+    touch(o.side, tick);
+
+    if (o.side == Side::Buy) {
+        bidLevels_.set(idx);
+        if (bestBid_ == npos || idx > bestBid_) bestBid_ = idx;
+    } else {
+        askLevels_.set(idx);
+        if (bestAsk_ == npos || idx < bestAsk_) bestAsk_ = idx;
+    }
+}
+
+// Take a slot out of its level's FIFO; an emptied level leaves the bitmap and, if it
+// was the touch, the next level behind it becomes best.
+template <typename PriceT, typename QtyT, typename Listener>
+template <Side S>
+void basic_orderbook<PriceT, QtyT, Listener>::unlink(std::uint32_t slot) {
+    const OrderNode& node = nodes_[slot];
+    std::size_t idx = static_cast<std::size_t>(node.tick - baseTick_);
+    PriceLevel& level = ladder_[idx];
+    if (node.prev != nil) nodes_[node.prev].next = node.next;
+    else level.head = node.next;
+    if (node.next != nil) nodes_[node.next].prev = node.prev;
+    else level.tail = node.prev;
+    level.quantity -= node.order.quantity;
+    --level.orders;
+    touch(S, node.tick);
+    if (!level.empty()) return;
+    --levels_;
+
+    if constexpr (S == Side::Buy) {
+        bidLevels_.clear(idx);
+        if (idx == bestBid_) bestBid_ = idx ? bidLevels_.prev(idx - 1) : npos;
+    } else {
+        askLevels_.clear(idx);
+        if (idx == bestAsk_) bestAsk_ = askLevels_.next(idx + 1);
+    }
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+void basic_orderbook<PriceT, QtyT, Listener>::unlink(std::uint32_t slot) {
+    if (nodes_[slot].order.side == Side::Buy) unlink<Side::Buy>(slot);
+    else unlink<Side::Sell>(slot);
 }
 
-ExecutionResults orderbook::addLimitOrder(double price, int quantity, Side side) { // Buy at a specified price or better, time is flexible
-    Order o{price, quantity, side, OrderType::Limit};
+template <typename PriceT, typename QtyT, typename Listener>
+void basic_orderbook<PriceT, QtyT, Listener>::releaseSlot(std::uint32_t slot) {
+    nodes_[slot].next = freeSlot_;
+    freeSlot_ = slot;
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+auto basic_orderbook<PriceT, QtyT, Listener>::addLimitOrder(PriceT price, QtyT quantity, Side side) -> ExecutionResults { // Buy at a specified price or better, time is flexible
+    ExecutionResults results = place(nextId_++, price, quantity, side);
+    fireStops(results);
+    return results;
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+auto basic_orderbook<PriceT, QtyT, Listener>::place(OrderId id, PriceT price, QtyT quantity, Side side) -> ExecutionResults {
     ExecutionResults results;
     results.traded = false;
     results.requested = quantity;
@@ -41,102 +293,480 @@ ExecutionResults orderbook::addLimitOrder(double price, int quantity, Side side)
     results.trades = 0;
     results.notional = 0.0;
 
-    if (side == Side::Buy) {
-        while (!sells_.empty() && o.quantity > 0) {
-            auto lowAsk = sells_.begin();
-            if (o.price < lowAsk->first) break;
-            auto &level = lowAsk->second;
-            while (o.quantity > 0 && !level.empty()) {
-                Order &bestAsk = level.front();
-                int tradeQty = std::min(o.quantity, bestAsk.quantity);
-                results.traded |= tradeQty > 0;
-                results.filled += tradeQty;
-                results.trades += tradeQty > 0 ? 1 : 0;
-                results.notional += static_cast<double>(tradeQty) * bestAsk.price;
-                o.quantity -= tradeQty;
-                bestAsk.quantity -= tradeQty;
-                if (bestAsk.quantity == 0) level.pop_front();
-            }
-            if (level.empty()) sells_.erase(lowAsk);
+    std::int64_t tick = toTick(price);
+    if (!fitTick(tick)) {
+        results.rejected = true;
+        return results;
+    }
+    results.id = id;
+    std::size_t idx = static_cast<std::size_t>(tick - baseTick_);
+    Order o{id, toPrice(idx), quantity, side, OrderType::Limit};
+
+    if (side == Side::Buy) sweep<Side::Buy, false>(id, o.quantity, idx, results);
+    else sweep<Side::Sell, false>(id, o.quantity, idx, results);
+    if (o.quantity > 0) rest(tick, o);
+    return results;
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+void basic_orderbook<PriceT, QtyT, Listener>::submitBatch(const OrderCommand* orders, std::size_t count, ExecutionResults* results) {
+    // Prices out past maxTick are left out; place() rejects them one by one below.
+    std::int64_t lo = std::numeric_limits<std::int64_t>::max();
+    std::int64_t hi = std::numeric_limits<std::int64_t>::min();
+    std::size_t limits = 0;
+    std::size_t buyStops = 0;
+    std::size_t sellStops = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        if (orders[i].type == OrderType::Stop || orders[i].type == OrderType::StopLimit) {
+            ++(orders[i].side == Side::Buy ? buyStops : sellStops);
+            continue;
         }
-        if (o.quantity > 0) buys_[o.price].push_back(o);
-    } else {
-        while (!buys_.empty() && o.quantity > 0) {
-            auto highBuy = buys_.begin();
-            if (o.price > highBuy->first) break;
-            auto &level = highBuy->second;
-            while (o.quantity > 0 && !level.empty()) {
-                Order &bestBid = level.front();
-                int tradeQty = std::min(o.quantity, bestBid.quantity);
-                results.traded |= tradeQty > 0;
-                results.filled += tradeQty;
-                results.trades += tradeQty > 0 ? 1 : 0;
-                results.notional += static_cast<double>(tradeQty) * bestBid.price;
-                o.quantity -= tradeQty;
-                bestBid.quantity -= tradeQty;
-                if (bestBid.quantity == 0) level.pop_front();
-            }
-            if (level.empty()) buys_.erase(highBuy);
+        if (orders[i].type != OrderType::Limit) continue;
+        ++limits;
+        std::int64_t tick = toTick(orders[i].price);
+        if (!tickOk(tick)) continue;
+        lo = std::min(lo, tick);
+        hi = std::max(hi, tick);
+    }
+    std::size_t stops = buyStops + sellStops;
+    if (limits || stops) {
+        // If the whole range can't fit, the orders that don't are rejected one by one below,
+        // just as they would be on their own.
+        if (lo <= hi) fitTicks(lo, hi);
+        // Waiting stops hold slots from the same pool, and so will the batch's own, which also
+        // go on the trigger heaps.
+        std::size_t need = orderCount() + stopCount() + limits + stops;
+        if (need > nodes_.size()) {
+            ++growths_;
+            reserve(need);
+        }
+        if (buyStops_.size() + buyStops > buyStops_.capacity()) {
+            ++growths_;
+            buyStops_.reserve(buyStops_.size() + buyStops);
         }
-        if (o.quantity > 0) sells_[o.price].push_back(o);
+        if (sellStops_.size() + sellStops > sellStops_.capacity()) {
+            ++growths_;
+            sellStops_.reserve(sellStops_.size() + sellStops);
+        }
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        const OrderCommand& o = orders[i];
+        switch (o.type) {
+            case OrderType::Limit: results[i] = place(nextId_++, o.price, o.quantity, o.side); break;
+            case OrderType::Market: results[i] = market(0, o.quantity, o.side); break;
+            case OrderType::Stop:
+            case OrderType::StopLimit: results[i] = placeStop(o.type, o.stopPrice, o.price, o.quantity, o.side); break;
+        }
+        fireStops(results[i]);
+    }
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+bool basic_orderbook<PriceT, QtyT, Listener>::cancel(OrderId id) {
+    std::uint32_t slot = index_.find(id);
+    if (slot == nil) return false;
+    index_.erase(id);
+    if (nodes_[slot].order.type != OrderType::Limit) { // a waiting stop: its heap entry goes stale
+        releaseSlot(slot);
+        --stopCount_;
+        if (buyStops_.size() + sellStops_.size() > 2 * stopCount_ + 1024) compactStops();
+        return true;
     }
+    unlink(slot);
+    releaseSlot(slot);
+    return true;
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+auto basic_orderbook<PriceT, QtyT, Listener>::modify(OrderId id, QtyT newQuantity) -> std::optional<ExecutionResults> {
+    std::uint32_t slot = index_.find(id);
+    if (slot == nil || nodes_[slot].order.type != OrderType::Limit) return std::nullopt;
+    return modify(id, newQuantity, nodes_[slot].order.price);
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+auto basic_orderbook<PriceT, QtyT, Listener>::modify(OrderId id, QtyT newQuantity, PriceT newPrice) -> std::optional<ExecutionResults> {
+    std::uint32_t slot = index_.find(id);
+    if (slot == nil || nodes_[slot].order.type != OrderType::Limit) return std::nullopt;
+    Order& o = nodes_[slot].order;
+
+    ExecutionResults results;
+    results.traded = false;
+    results.requested = newQuantity;
+    results.filled = 0;
+    results.trades = 0;
+    results.notional = 0.0;
+    results.id = id;
+
+    std::int64_t tick = toTick(newPrice);
+    if (newQuantity <= 0) {
+        cancel(id);
+        return results;
+    }
+    if (tick == nodes_[slot].tick && newQuantity <= o.quantity) { // shrink in place, keep our spot in the queue
+        ladder_[static_cast<std::size_t>(nodes_[slot].tick - baseTick_)].quantity -= o.quantity - newQuantity;
+        o.quantity = newQuantity;
+        touch(o.side, nodes_[slot].tick);
+        return results;
+    }
+    if (!fitTick(tick)) { // leave the original order alone
+        results.rejected = true;
+        return results;
+    }
+    Side side = o.side;
+    index_.erase(id);
+    unlink(slot);
+    releaseSlot(slot);
+    results = place(id, newPrice, newQuantity, side);
+    fireStops(results);
     return results;
 }
 
-ExecutionResults orderbook::addMarketOrder(int quantity, Side side) { // Buy now no matter what for the set amount
+template <typename PriceT, typename QtyT, typename Listener>
+auto basic_orderbook<PriceT, QtyT, Listener>::addMarketOrder(QtyT quantity, Side side) -> ExecutionResults { // Buy now no matter what for the set amount
+    ExecutionResults results = market(0, quantity, side);
+    fireStops(results);
+    return results;
+}
+
+// Market orders have no id unless they're a stop going off; whatever doesn't fill is dropped.
+template <typename PriceT, typename QtyT, typename Listener>
+auto basic_orderbook<PriceT, QtyT, Listener>::market(OrderId id, QtyT quantity, Side side) -> ExecutionResults {
     ExecutionResults results;
     results.traded = false;
     results.filled = 0;
     results.requested = quantity;
     results.trades = 0;
     results.notional = 0.0;
-    if (side == Side::Buy) {
-        while (quantity > 0 && !sells_.empty()) {
-            auto lowAsk = sells_.begin();
-            auto &level = lowAsk->second;
-            while (!level.empty() && quantity > 0) {
-                Order &bestAsk = level.front();
-                int tradeQty = std::min(quantity, bestAsk.quantity);
-                results.traded |= tradeQty > 0;
-                results.filled += tradeQty;
-                results.trades += tradeQty > 0 ? 1 : 0;
-                results.notional += static_cast<double>(tradeQty) * bestAsk.price;
-                quantity -= tradeQty;
-                bestAsk.quantity -= tradeQty;
-                if (bestAsk.quantity == 0) level.pop_front();
-            }
-            if (level.empty()) sells_.erase(lowAsk);
+    if (side == Side::Buy) sweep<Side::Buy, true>(id, quantity, 0, results);
+    else sweep<Side::Sell, true>(id, quantity, 0, results);
+    return results;
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+auto basic_orderbook<PriceT, QtyT, Listener>::addStopOrder(PriceT stopPrice, QtyT quantity, Side side) -> ExecutionResults {
+    return placeStop(OrderType::Stop, stopPrice, PriceT{}, quantity, side);
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+auto basic_orderbook<PriceT, QtyT, Listener>::addStopLimitOrder(PriceT stopPrice, PriceT price, QtyT quantity, Side side) -> ExecutionResults {
+    return placeStop(OrderType::StopLimit, stopPrice, price, quantity, side);
+}
+
+// Nothing can trade here, so there's nothing to fire. The limit price is snapped now, which
+// is what place() would do with it later anyway.
+template <typename PriceT, typename QtyT, typename Listener>
+auto basic_orderbook<PriceT, QtyT, Listener>::placeStop(OrderType type, PriceT stopPrice, PriceT price, QtyT quantity, Side side)
+    -> ExecutionResults {
+    ExecutionResults results;
+    results.traded = false;
+    results.filled = 0;
+    results.requested = quantity;
+    results.trades = 0;
+    results.notional = 0.0;
+    OrderId id = nextId_++; // used up even if rejected, like a limit
+    std::int64_t tick = toTick(stopPrice);
+    std::int64_t limitTick = type == OrderType::StopLimit ? toTick(price) : 0;
+    if (!tickOk(tick) || !tickOk(limitTick)) {
+        results.rejected = true;
+        return results;
+    }
+    results.id = id;
+    std::uint32_t slot = takeSlot();
+    nodes_[slot] = OrderNode{Order{results.id, type == OrderType::StopLimit ? tickPrice(limitTick) : PriceT{}, quantity, side, type},
+                             tick, nil, nil};
+    index_.insert(results.id, slot);
+    pushStop(side, tick, results.id);
+    return results;
+}
+
+namespace {
+
+// Heap orders: the top is the buy stop with the lowest tick and the sell stop with the
+// highest, the earlier id first on a tie.
+template <typename Entry>
+bool buyAfter(const Entry& a, const Entry& b) { return a.tick != b.tick ? a.tick > b.tick : a.id > b.id; }
+template <typename Entry>
+bool sellAfter(const Entry& a, const Entry& b) { return a.tick != b.tick ? a.tick < b.tick : a.id > b.id; }
+
+} // namespace
+
+template <typename PriceT, typename QtyT, typename Listener>
+void basic_orderbook<PriceT, QtyT, Listener>::pushStop(Side side, std::int64_t tick, OrderId id) {
+    auto& heap = side == Side::Buy ? buyStops_ : sellStops_;
+    if (heap.size() == heap.capacity()) ++growths_;
+    heap.push_back({tick, id});
+    if (side == Side::Buy) std::push_heap(heap.begin(), heap.end(), buyAfter<StopEntry>);
+    else std::push_heap(heap.begin(), heap.end(), sellAfter<StopEntry>);
+    ++stopCount_;
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+void basic_orderbook<PriceT, QtyT, Listener>::compactStops() {
+    auto dead = [this](const StopEntry& e) { return index_.find(e.id) == nil; };
+    buyStops_.erase(std::remove_if(buyStops_.begin(), buyStops_.end(), dead), buyStops_.end());
+    sellStops_.erase(std::remove_if(sellStops_.begin(), sellStops_.end(), dead), sellStops_.end());
+    std::make_heap(buyStops_.begin(), buyStops_.end(), buyAfter<StopEntry>);
+    std::make_heap(sellStops_.begin(), sellStops_.end(), sellAfter<StopEntry>);
+}
+
+// Called at the end of every public call that can trade. Takes every stop the prints since
+// the last look have crossed off its heap, sets them off oldest first, and goes round again
+// while those trades cross more. With no trades, or no stop near them, this is a compare or two.
+template <typename PriceT, typename QtyT, typename Listener>
+void basic_orderbook<PriceT, QtyT, Listener>::fireStops(ExecutionResults& results) {
+    while (tradeLow_ <= tradeHigh_) {
+        std::int64_t low = tradeLow_;
+        std::int64_t high = tradeHigh_;
+        tradeLow_ = std::numeric_limits<std::int64_t>::max();
+        tradeHigh_ = std::numeric_limits<std::int64_t>::min();
+        if (stopCount_ == 0) return;
+
+        firing_.clear();
+        auto take = [this](std::vector<StopEntry>& heap, bool (*after)(const StopEntry&, const StopEntry&)) {
+            std::pop_heap(heap.begin(), heap.end(), after);
+            std::uint32_t slot = index_.find(heap.back().id);
+            heap.pop_back();
+            if (slot != nil) firing_.push_back(slot); // nil: cancelled while it waited
+        };
+        while (!buyStops_.empty() && buyStops_.front().tick <= high) take(buyStops_, buyAfter<StopEntry>);
+        while (!sellStops_.empty() && sellStops_.front().tick >= low) take(sellStops_, sellAfter<StopEntry>);
+        if (firing_.size() > 1) {
+            std::sort(firing_.begin(), firing_.end(), [this](std::uint32_t a, std::uint32_t b) { return nodes_[a].order.id < nodes_[b].order.id; });
         }
-    } else {
-        while (quantity > 0 && !buys_.empty()) {
-            auto highBid = buys_.begin();
-            auto &level = highBid->second;
-            while (!level.empty() && quantity > 0) {
-                Order &bestBid = level.front();
-                int tradeQty = std::min(quantity, bestBid.quantity);
-                results.traded |= tradeQty > 0;
-                results.filled += tradeQty;
-                results.trades += tradeQty > 0 ? 1 : 0;
-                results.notional += static_cast<double>(tradeQty) * bestBid.price;
-                quantity -= tradeQty;
-                bestBid.quantity -= tradeQty;
-                if (bestBid.quantity == 0) level.pop_front();
-            }
-            if (level.empty()) buys_.erase(highBid);
+
+        for (std::uint32_t slot : firing_) {
+            Order o = nodes_[slot].order;
+            index_.erase(o.id);
+            releaseSlot(slot);
+            --stopCount_;
+            ++results.triggered;
+            ExecutionResults fired = o.type == OrderType::StopLimit ? place(o.id, o.price, o.quantity, o.side)
+                                                                    : market(o.id, o.quantity, o.side);
+            results.stopTrades += fired.trades;
+            results.stopFilled += fired.filled;
         }
     }
-    return results;
 }
 
-BookSnapshot orderbook::snapshot(std::size_t depth) const {
+// O(depth): level totals are already maintained, so no order is touched here.
+template <typename PriceT, typename QtyT, typename Listener>
+auto basic_orderbook<PriceT, QtyT, Listener>::snapshot(std::size_t depth) const -> BookSnapshot {
     BookSnapshot snapshot;
-    for (auto it = buys_.begin(); it != buys_.end() && snapshot.bids.size() < depth; ++it) {
-        int qty = 0; for (const auto& p : it->second) qty += p.quantity;
-        snapshot.bids.push_back({it->first, qty});
+    this->snapshot(depth, snapshot);
+    return snapshot;
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+void basic_orderbook<PriceT, QtyT, Listener>::snapshot(std::size_t depth, BookSnapshot& snapshot) const {
+    snapshot.bids.clear();
+    snapshot.asks.clear();
+    for (std::size_t i = bestBid_; i != npos && snapshot.bids.size() < depth; i = i ? bidLevels_.prev(i - 1) : npos) {
+        snapshot.bids.push_back(levelAt(i));
     }
-    for (auto it = sells_.begin(); it != sells_.end() && snapshot.asks.size() < depth; ++it) {
-        int qty = 0; for (const auto& p : it->second) qty += p.quantity;
-        snapshot.asks.push_back({it->first, qty});
+    for (std::size_t i = bestAsk_; i != npos && snapshot.asks.size() < depth; i = askLevels_.next(i + 1)) {
+        snapshot.asks.push_back(levelAt(i));
     }
-    return snapshot;
 }
+
+template <typename PriceT, typename QtyT, typename Listener>
+auto basic_orderbook<PriceT, QtyT, Listener>::bestBid() const -> std::optional<BookLevel> {
+    if (bestBid_ == npos) return std::nullopt;
+    return levelAt(bestBid_);
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+auto basic_orderbook<PriceT, QtyT, Listener>::bestAsk() const -> std::optional<BookLevel> {
+    if (bestAsk_ == npos) return std::nullopt;
+    return levelAt(bestAsk_);
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+std::optional<PriceT> basic_orderbook<PriceT, QtyT, Listener>::spread() const {
+    if (bestBid_ == npos || bestAsk_ == npos) return std::nullopt;
+    return tickPrice(static_cast<std::int64_t>(bestAsk_ - bestBid_));
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+void basic_orderbook<PriceT, QtyT, Listener>::captureChanges(bool on) {
+    capture_ = on;
+    touched_.clear();
+    trades_.clear();
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+bool basic_orderbook<PriceT, QtyT, Listener>::takeChanges(std::vector<LevelUpdate>& levels, std::vector<TradePrint>& trades) {
+    if (touched_.empty() && trades_.empty()) return false;
+    std::sort(touched_.begin(), touched_.end(), [](const Touch& a, const Touch& b) {
+        return a.side != b.side ? a.side < b.side : a.tick < b.tick;
+    });
+    for (std::size_t i = 0; i < touched_.size(); ++i) {
+        const Touch& t = touched_[i];
+        if (i && t.tick == touched_[i - 1].tick && t.side == touched_[i - 1].side) continue;
+        LevelUpdate update{t.side, tickPrice(t.tick), 0, 0};
+        std::int64_t idx = t.tick - baseTick_;
+        if (idx >= 0 && idx < static_cast<std::int64_t>(ladder_.size())) {
+            const LevelBitmap& bits = t.side == Side::Buy ? bidLevels_ : askLevels_;
+            if (bits.test(static_cast<std::size_t>(idx))) {
+                update.qty = ladder_[static_cast<std::size_t>(idx)].quantity;
+                update.orders = ladder_[static_cast<std::size_t>(idx)].orders;
+            }
+        }
+        levels.push_back(update);
+    }
+    trades.insert(trades.end(), trades_.begin(), trades_.end());
+    touched_.clear();
+    trades_.clear();
+    return true;
+}
+
+namespace {
+
+constexpr std::uint32_t imageMagic = 0x4b42424f; // "OBBK"
+constexpr std::uint32_t imageVersion = 3; // 1 had 24-byte orders with a 32-bit qty, 2 no stops; both still readable
+
+struct ImageHeader {
+    std::uint32_t magic;
+    std::uint32_t version;
+    double tickSize;
+    std::uint64_t nextId;
+    std::uint64_t orders;
+};
+
+// Stops come after the resting orders; tick is the stop tick and limitTick a stop-limit's price.
+struct ImageOrder {
+    std::uint64_t id;
+    std::int64_t tick;
+    std::int64_t quantity;
+    std::uint8_t side;
+    std::uint8_t type;
+    std::uint8_t pad[6];
+    std::int64_t limitTick;
+};
+
+struct ImageOrderV2 {
+    std::uint64_t id;
+    std::int64_t tick;
+    std::int64_t quantity;
+    std::uint8_t side;
+    std::uint8_t pad[7];
+};
+
+struct ImageOrderV1 {
+    std::uint64_t id;
+    std::int64_t tick;
+    std::int32_t quantity;
+    std::uint8_t side;
+    std::uint8_t pad[3];
+};
+
+static_assert(sizeof(ImageHeader) == 32 && sizeof(ImageOrder) == 40 && sizeof(ImageOrderV2) == 32 && sizeof(ImageOrderV1) == 24);
+
+} // namespace
+
+template <typename PriceT, typename QtyT, typename Listener>
+void basic_orderbook<PriceT, QtyT, Listener>::save(vector<char>& out) const {
+    std::size_t start = out.size();
+    std::uint64_t orders = index_.size();
+    out.resize(start + sizeof(ImageHeader) + orders * sizeof(ImageOrder));
+    char* at = out.data() + start + sizeof(ImageHeader);
+    auto writeLevel = [&](std::size_t idx) {
+        for (std::uint32_t slot = ladder_[idx].head; slot != nil; slot = nodes_[slot].next) {
+            const OrderNode& node = nodes_[slot];
+            ImageOrder image{node.order.id, node.tick, static_cast<std::int64_t>(node.order.quantity),
+                             static_cast<std::uint8_t>(node.order.side), static_cast<std::uint8_t>(OrderType::Limit), {}, 0};
+            std::memcpy(at, &image, sizeof(image));
+            at += sizeof(image);
+        }
+    };
+    for (std::size_t i = bestBid_; i != npos; i = i ? bidLevels_.prev(i - 1) : npos) writeLevel(i);
+    for (std::size_t i = bestAsk_; i != npos; i = askLevels_.next(i + 1)) writeLevel(i);
+    auto writeStops = [&](const std::vector<StopEntry>& heap) {
+        for (const StopEntry& entry : heap) {
+            std::uint32_t slot = index_.find(entry.id);
+            if (slot == nil) continue; // cancelled
+            const Order& o = nodes_[slot].order;
+            ImageOrder image{o.id, entry.tick, static_cast<std::int64_t>(o.quantity), static_cast<std::uint8_t>(o.side),
+                             static_cast<std::uint8_t>(o.type), {}, o.type == OrderType::StopLimit ? toTick(o.price) : 0};
+            std::memcpy(at, &image, sizeof(image));
+            at += sizeof(image);
+        }
+    };
+    writeStops(buyStops_);
+    writeStops(sellStops_);
+
+    ImageHeader header{imageMagic, imageVersion, tickSize(), nextId_, orders};
+    std::memcpy(out.data() + start, &header, sizeof(header));
+}
+
+template <typename PriceT, typename QtyT, typename Listener>
+bool basic_orderbook<PriceT, QtyT, Listener>::restore(const char* data, std::size_t size) {
+    clear();
+    ImageHeader header;
+    if (size < sizeof(header)) return false;
+    std::memcpy(&header, data, sizeof(header));
+    std::size_t record = header.version == 1 ? sizeof(ImageOrderV1) : header.version == 2 ? sizeof(ImageOrderV2) : sizeof(ImageOrder);
+    if (header.magic != imageMagic || header.version < 1 || header.version > imageVersion ||
+        std::abs(header.tickSize * ticksPerUnit_ - 1.0) > 1e-9 ||
+        header.orders > (size - sizeof(header)) / record || size != sizeof(header) + header.orders * record) {
+        return false;
+    }
+    reserve(static_cast<std::size_t>(header.orders));
+    const char* at = data + sizeof(header);
+    // Ids in queue order land all over the index, so fetch the bucket a few orders ahead.
+    constexpr std::uint64_t ahead = 16;
+    for (std::uint64_t n = 0; n < header.orders; ++n, at += record) {
+        if (n + ahead < header.orders) {
+            std::uint64_t id;
+            std::memcpy(&id, at + ahead * record, sizeof(id));
+            index_.prefetch(id);
+        }
+        ImageOrder image;
+        if (header.version == 1) {
+            ImageOrderV1 old;
+            std::memcpy(&old, at, sizeof(old));
+            image = ImageOrder{old.id, old.tick, old.quantity, old.side, 0, {}, 0};
+        } else if (header.version == 2) {
+            ImageOrderV2 old;
+            std::memcpy(&old, at, sizeof(old));
+            image = ImageOrder{old.id, old.tick, old.quantity, old.side, 0, {}, 0};
+        } else {
+            std::memcpy(&image, at, sizeof(image));
+        }
+        auto type = static_cast<OrderType>(image.type);
+        bool stop = type == OrderType::Stop || type == OrderType::StopLimit;
+        if (image.quantity <= 0 || image.quantity > std::numeric_limits<QtyT>::max() || image.side > 1 ||
+            (type != OrderType::Limit && !stop) || (!stop && !fitTick(image.tick)) ||
+            (stop && (!tickOk(image.tick) || !tickOk(image.limitTick))) || index_.find(image.id) != nil) {
+            clear();
+            return false;
+        }
+        if (stop) {
+            std::uint32_t slot = takeSlot();
+            PriceT price = type == OrderType::StopLimit ? tickPrice(image.limitTick) : PriceT{};
+            nodes_[slot] = OrderNode{Order{image.id, price, static_cast<QtyT>(image.quantity), static_cast<Side>(image.side), type},
+                                     image.tick, nil, nil};
+            index_.insert(image.id, slot);
+            pushStop(static_cast<Side>(image.side), image.tick, image.id);
+            continue;
+        }
+        std::size_t idx = static_cast<std::size_t>(image.tick - baseTick_);
+        // A level belongs to one side; an image resting both on a tick is corrupt.
+        if ((static_cast<Side>(image.side) == Side::Buy ? askLevels_ : bidLevels_).test(idx)) {
+            clear();
+            return false;
+        }
+        // Orders arrive in queue order, so appending each to its level's tail rebuilds priority.
+        rest(image.tick, Order{image.id, toPrice(idx), static_cast<QtyT>(image.quantity), static_cast<Side>(image.side), OrderType::Limit});
+    }
+    if (bestBid_ != npos && bestAsk_ != npos && bestBid_ >= bestAsk_) { // a live book never rests crossed
+        clear();
+        return false;
+    }
+    nextId_ = header.nextId;
+    return true;
+}
+
+template class basic_orderbook<double, int, NoFillListener>;
+template class basic_orderbook<double, int, RingFillListener>;
+template class basic_orderbook<std::int64_t, std::int64_t, NoFillListener>;
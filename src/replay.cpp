@@ -0,0 +1,508 @@
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "binary_protocol.h"
+#include "orderbook.h"
+
+using std::cout;
+using std::string;
+
+// Streams a recorded order flow through one book without the server: a CSV or the compact
+// binary format below, mapped and parsed in place (nothing is allocated per line). Prints
+// the final book and throughput, and optionally every trade.
+//
+// CSV, one command per line, columns kind,side,price,qty,id (trailing empties can go):
+//   L,B,100.25,10      limit buy 10 @ 100.25
+//   M,S,,5             market sell 5
+//   C,,,,42            cancel order 42
+//   R,,101.5,5,42      modify 42 to 5 @ 101.5 (leave price empty to keep it)
+// Blank lines and lines starting with # are skipped, and so is a first line that isn't a
+// command (a header). Ids are the ones the book hands out: limits are numbered 1, 2, 3...
+// in file order, same as the engine everywhere else.
+
+namespace {
+
+constexpr char flowMagic[8] = {'O', 'B', 'F', 'L', 'O', 'W', '\0', '\0'};
+constexpr std::uint32_t flowVersion = 1;
+
+struct FlowHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t recordSize;
+};
+
+// Binary flow record. kind is the CSV letter; price is fixed point like the binary
+// gateway (price * wire::priceScale).
+struct FlowRecord {
+    std::uint8_t kind;
+    std::uint8_t side;      // Side
+    std::uint8_t hasPrice;  // modify only
+    std::uint8_t pad;
+    std::int32_t qty;
+    std::int64_t price;
+    std::uint64_t id;
+};
+
+static_assert(sizeof(FlowHeader) == 16 && sizeof(FlowRecord) == 24);
+
+struct Options {
+    string input;
+    string tradesPath;      // "-" for stdout
+    string binaryOut;       // convert the CSV instead of replaying it
+    double tickSize{0.01};
+    std::size_t reserve{1u << 20};
+    std::size_t depth{10};
+    bool progress{true};
+};
+
+struct Stats {
+    std::uint64_t commands{0};
+    std::uint64_t limits{0};
+    std::uint64_t markets{0};
+    std::uint64_t cancels{0};
+    std::uint64_t modifies{0};
+    std::uint64_t rejected{0};      // limit too far from the book for the ladder
+    std::uint64_t missed{0};        // cancel/modify of an id that wasn't resting
+    std::uint64_t trades{0};
+    std::uint64_t filled{0};
+};
+
+// Read-only mapping of the whole input. Pages already parsed are dropped every so often,
+// so a file much bigger than RAM streams through without crowding out everything else.
+class MappedFile {
+public:
+    explicit MappedFile(const string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("can't open " + path + ": " + std::strerror(errno));
+        struct stat st{};
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("can't stat " + path);
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        if (size_ > 0) {
+            void* map = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("can't map " + path + ": " + std::strerror(errno));
+            }
+            data_ = static_cast<const char*>(map);
+            ::madvise(map, size_, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+    }
+    ~MappedFile() {
+        if (data_) ::munmap(const_cast<char*>(data_), size_);
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+
+    // Everything before `upto` has been consumed.
+    void release(std::size_t upto) {
+        constexpr std::size_t step = 64u << 20;
+        if (upto < released_ + step) return;
+        std::size_t end = upto & ~(step - 1);
+        ::madvise(const_cast<char*>(data_) + released_, end - released_, MADV_DONTNEED);
+        released_ = end;
+    }
+
+private:
+    const char* data_{nullptr};
+    std::size_t size_{0};
+    std::size_t released_{0};
+};
+
+// Buffered writer that formats straight into a fixed buffer. Callers reserve() room first.
+class Out {
+public:
+    explicit Out(std::FILE* f) : f_(f), buf_(1u << 20) {}
+    ~Out() { flush(); }
+    void flush() {
+        if (len_) std::fwrite(buf_.data(), 1, len_, f_);
+        len_ = 0;
+    }
+    void reserve(std::size_t n) {
+        if (len_ + n > buf_.size()) flush();
+    }
+    void put(char c) { buf_[len_++] = c; }
+    void put(const char* s, std::size_t n) {
+        std::memcpy(buf_.data() + len_, s, n);
+        len_ += n;
+    }
+    template <typename T>
+    void num(T v) {
+        len_ = static_cast<std::size_t>(std::to_chars(buf_.data() + len_, buf_.data() + buf_.size(), v).ptr - buf_.data());
+    }
+
+private:
+    std::FILE* f_;
+    std::vector<char> buf_;
+    std::size_t len_{0};
+};
+
+// One parsed command, the same shape whichever format it came from.
+struct Command {
+    char kind;
+    Side side;
+    bool hasPrice;
+    int qty;
+    double price;
+    OrderId id;
+};
+
+// Splits [p, end) on commas into at most 5 fields. Returns false on a malformed line.
+bool parseCsvLine(const char* p, const char* end, Command& c) {
+    const char* field[5] = {};
+    const char* fieldEnd[5] = {};
+    int n = 0;
+    while (n < 5) {
+        field[n] = p;
+        while (p != end && *p != ',') ++p;
+        fieldEnd[n++] = p;
+        if (p == end) break;
+        ++p;
+    }
+    if (p != end) return false; // more than 5 columns
+    auto empty = [&](int i) { return i >= n || field[i] == fieldEnd[i]; };
+    auto integer = [&](int i, auto& out) {
+        auto r = std::from_chars(field[i], fieldEnd[i], out);
+        return !empty(i) && r.ec == std::errc{} && r.ptr == fieldEnd[i];
+    };
+
+    if (fieldEnd[0] - field[0] != 1) return false;
+    c.kind = static_cast<char>(*field[0] & ~0x20); // upper case
+    c.hasPrice = !empty(2);
+    if (c.hasPrice) {
+        auto r = std::from_chars(field[2], fieldEnd[2], c.price);
+        if (r.ec != std::errc{} || r.ptr != fieldEnd[2]) return false;
+    }
+    if (c.kind == 'L' || c.kind == 'M') {
+        if (empty(1)) return false;
+        char s = static_cast<char>(*field[1] & ~0x20);
+        if (s != 'B' && s != 'S') return false;
+        c.side = s == 'B' ? Side::Buy : Side::Sell;
+        return integer(3, c.qty) && c.qty > 0 && (c.kind == 'M' || c.hasPrice);
+    }
+    if (c.kind == 'C') return integer(4, c.id);
+    if (c.kind == 'R') return integer(3, c.qty) && c.qty > 0 && integer(4, c.id);
+    return false;
+}
+
+void printTrades(Out& out, std::uint64_t command, const std::vector<TradePrint>& trades) {
+    for (const auto& t : trades) {
+        out.reserve(64);
+        out.num(command);
+        out.put(',');
+        out.num(t.price);
+        out.put(',');
+        out.num(t.qty);
+        out.put(t.aggressor == Side::Buy ? ",buy\n" : ",sell\n", t.aggressor == Side::Buy ? 5 : 6);
+    }
+}
+
+class Replayer {
+public:
+    Replayer(const Options& opt, Stats& stats, Out* trades)
+        : book_(config(opt)), stats_(stats), trades_(trades) {
+        if (trades_) {
+            book_.captureChanges(true);
+            trades_->reserve(64);
+            trades_->put("command,price,qty,aggressor\n", 28);
+        }
+    }
+
+    orderbook& book() { return book_; }
+
+    void run(const Command& c) {
+        ++stats_.commands;
+        ExecutionResults r{};
+        switch (c.kind) {
+            case 'L':
+                ++stats_.limits;
+                r = book_.addLimitOrder(c.price, c.qty, c.side);
+                stats_.rejected += r.rejected;
+                break;
+            case 'M':
+                ++stats_.markets;
+                r = book_.addMarketOrder(c.qty, c.side);
+                break;
+            case 'C':
+                ++stats_.cancels;
+                stats_.missed += !book_.cancel(c.id);
+                break;
+            case 'R': {
+                ++stats_.modifies;
+                auto m = c.hasPrice ? book_.modify(c.id, c.qty, c.price) : book_.modify(c.id, c.qty);
+                if (m) r = *m;
+                else ++stats_.missed;
+                break;
+            }
+        }
+        stats_.trades += static_cast<std::uint64_t>(r.trades);
+        stats_.filled += static_cast<std::uint64_t>(r.filled);
+        // Touched levels pile up in the book too, so drain them now and then even without trades.
+        if (trades_ && (r.trades > 0 || (stats_.commands & 4095) == 0)) {
+            book_.takeChanges(levels_, prints_);
+            printTrades(*trades_, stats_.commands, prints_);
+            levels_.clear();
+            prints_.clear();
+        }
+    }
+
+private:
+    static BookConfig config(const Options& opt) {
+        BookConfig c;
+        c.tickSize = opt.tickSize;
+        c.reserveOrders = opt.reserve;
+        return c;
+    }
+
+    orderbook book_;
+    Stats& stats_;
+    Out* trades_;
+    std::vector<LevelUpdate> levels_;
+    std::vector<TradePrint> prints_;
+};
+
+// Prints the rate since the last report about once a second while a long file runs.
+class Progress {
+public:
+    using clock = std::chrono::steady_clock;
+    explicit Progress(bool on) : on_(on), start_(clock::now()), last_(start_) {}
+
+    void tick(const Stats& stats, std::size_t bytes) {
+        if (!on_ || (stats.commands & 0xfffff) != 0) return;
+        auto now = clock::now();
+        double secs = std::chrono::duration<double>(now - last_).count();
+        if (secs < 1.0) return;
+        std::cerr << std::fixed << std::setprecision(0) << stats.commands << " commands, "
+                  << static_cast<double>(stats.commands - lastCommands_) / secs << "/s, "
+                  << static_cast<double>(bytes - lastBytes_) / secs / 1e6 << " MB/s\n";
+        last_ = now;
+        lastCommands_ = stats.commands;
+        lastBytes_ = bytes;
+    }
+    double elapsed() const { return std::chrono::duration<double>(clock::now() - start_).count(); }
+
+private:
+    bool on_;
+    clock::time_point start_;
+    clock::time_point last_;
+    std::uint64_t lastCommands_{0};
+    std::size_t lastBytes_{0};
+};
+
+bool isBinary(const MappedFile& file) {
+    return file.size() >= sizeof(FlowHeader) && std::memcmp(file.data(), flowMagic, sizeof(flowMagic)) == 0;
+}
+
+// Calls fn(command, bytesConsumed) for every command in a CSV mapping.
+template <typename Fn>
+void forEachCsv(MappedFile& file, Fn&& fn) {
+    const char* base = file.data();
+    const char* p = base;
+    const char* end = base + file.size();
+    std::uint64_t line = 0;
+    while (p < end) {
+        const char* eol = static_cast<const char*>(std::memchr(p, '\n', static_cast<std::size_t>(end - p)));
+        if (!eol) eol = end;
+        const char* last = eol;
+        if (last != p && last[-1] == '\r') --last;
+        ++line;
+        if (last != p && *p != '#') {
+            Command c{};
+            if (parseCsvLine(p, last, c)) {
+                fn(c, static_cast<std::size_t>(eol - base));
+            } else if (line != 1) {
+                throw std::runtime_error("bad command on line " + std::to_string(line) + ": " + string(p, last));
+            }
+        }
+        p = eol + 1;
+    }
+}
+
+template <typename Fn>
+void forEachBinary(MappedFile& file, Fn&& fn) {
+    FlowHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (header.version != flowVersion || header.recordSize != sizeof(FlowRecord)) {
+        throw std::runtime_error("not a version " + std::to_string(flowVersion) + " flow file");
+    }
+    if ((file.size() - sizeof(header)) % sizeof(FlowRecord) != 0) throw std::runtime_error("flow file ends mid-record");
+    // The header is 16 bytes and records 24, so every record is 8-aligned in the mapping.
+    const auto* records = reinterpret_cast<const FlowRecord*>(file.data() + sizeof(header));
+    std::size_t count = (file.size() - sizeof(header)) / sizeof(FlowRecord);
+    for (std::size_t i = 0; i < count; ++i) {
+        const FlowRecord& r = records[i];
+        bool sized = r.kind == 'C' || r.qty > 0;
+        if ((r.kind != 'L' && r.kind != 'M' && r.kind != 'C' && r.kind != 'R') || r.side > 1 || !sized) {
+            throw std::runtime_error("bad record " + std::to_string(i + 1));
+        }
+        Command c{static_cast<char>(r.kind), static_cast<Side>(r.side), r.hasPrice != 0, r.qty,
+                  static_cast<double>(r.price) / wire::priceScale, r.id};
+        fn(c, sizeof(header) + (i + 1) * sizeof(FlowRecord));
+    }
+}
+
+void printBook(orderbook& book, std::size_t depth) {
+    BookSnapshot snap = book.snapshot(depth);
+    cout << std::fixed << std::setprecision(4);
+    cout << "\nfinal book (top " << depth << ")\n";
+    cout << std::setw(12) << "bid qty" << std::setw(8) << "orders" << std::setw(14) << "bid" << std::setw(14) << "ask"
+         << std::setw(8) << "orders" << std::setw(12) << "ask qty" << '\n';
+    for (std::size_t i = 0; i < std::max(snap.bids.size(), snap.asks.size()); ++i) {
+        if (i < snap.bids.size()) {
+            cout << std::setw(12) << snap.bids[i].qty << std::setw(8) << snap.bids[i].orders << std::setw(14) << snap.bids[i].price;
+        } else {
+            cout << std::setw(34) << "";
+        }
+        if (i < snap.asks.size()) {
+            cout << std::setw(14) << snap.asks[i].price << std::setw(8) << snap.asks[i].orders << std::setw(12) << snap.asks[i].qty;
+        }
+        cout << '\n';
+    }
+    if (auto s = book.spread()) cout << "spread " << *s << '\n';
+}
+
+void printStats(const Stats& s, std::size_t bytes, double secs) {
+    cout << std::fixed << std::setprecision(1);
+    cout << "\n" << s.commands << " commands (" << s.limits << " limit, " << s.markets << " market, " << s.cancels
+         << " cancel, " << s.modifies << " modify) in " << secs * 1000.0 << " ms\n";
+    cout << s.trades << " trades, " << s.filled << " filled, " << s.rejected << " rejected limits, " << s.missed
+         << " cancels/modifies of orders that weren't resting\n";
+    cout << std::setprecision(0) << static_cast<double>(s.commands) / secs << " commands/s, " << std::setprecision(1)
+         << static_cast<double>(bytes) / secs / 1e6 << " MB/s, " << secs * 1e9 / static_cast<double>(std::max<std::uint64_t>(s.commands, 1))
+         << " ns/command\n";
+}
+
+int replay(const Options& opt) {
+    MappedFile file(opt.input);
+    std::FILE* tradesFile = nullptr;
+    if (!opt.tradesPath.empty()) {
+        tradesFile = opt.tradesPath == "-" ? stdout : std::fopen(opt.tradesPath.c_str(), "w");
+        if (!tradesFile) throw std::runtime_error("can't create " + opt.tradesPath);
+    }
+
+    Stats stats;
+    double secs;
+    {
+        std::unique_ptr<Out> trades(tradesFile ? new Out(tradesFile) : nullptr);
+        Replayer replayer(opt, stats, trades.get());
+        Progress progress(opt.progress);
+        auto step = [&](const Command& c, std::size_t consumed) {
+            replayer.run(c);
+            progress.tick(stats, consumed);
+            if ((stats.commands & 0xffff) == 0) file.release(consumed);
+        };
+        if (isBinary(file)) forEachBinary(file, step);
+        else forEachCsv(file, step);
+        secs = progress.elapsed();
+        if (trades) trades->flush();
+        if (tradesFile == stdout) std::fflush(stdout);
+        printBook(replayer.book(), opt.depth);
+    }
+    if (tradesFile && tradesFile != stdout) std::fclose(tradesFile);
+    printStats(stats, file.size(), secs);
+    return 0;
+}
+
+// CSV -> binary flow file. Prices are rounded to the binary gateway's fixed point.
+int convert(const Options& opt) {
+    MappedFile file(opt.input);
+    if (isBinary(file)) throw std::runtime_error(opt.input + " is already a binary flow file");
+    std::FILE* f = std::fopen(opt.binaryOut.c_str(), "wb");
+    if (!f) throw std::runtime_error("can't create " + opt.binaryOut);
+    std::uint64_t count = 0;
+    {
+        Out out(f);
+        FlowHeader header{};
+        std::memcpy(header.magic, flowMagic, sizeof(flowMagic));
+        header.version = flowVersion;
+        header.recordSize = sizeof(FlowRecord);
+        out.put(reinterpret_cast<const char*>(&header), sizeof(header));
+        forEachCsv(file, [&](const Command& c, std::size_t consumed) {
+            FlowRecord r{static_cast<std::uint8_t>(c.kind), static_cast<std::uint8_t>(c.side), c.hasPrice, 0, c.qty,
+                         c.hasPrice ? std::llround(c.price * wire::priceScale) : 0, c.kind == 'C' || c.kind == 'R' ? c.id : 0};
+            out.reserve(sizeof(r));
+            out.put(reinterpret_cast<const char*>(&r), sizeof(r));
+            if ((++count & 0xffff) == 0) file.release(consumed);
+        });
+    }
+    bool ok = std::fclose(f) == 0;
+    if (!ok) throw std::runtime_error("can't write " + opt.binaryOut);
+    cout << "wrote " << count << " commands to " << opt.binaryOut << '\n';
+    return 0;
+}
+
+void usage() {
+    cout << "orderbook_replay FILE [--trades out.csv|-] [--depth N] [--tick 0.01] [--reserve N] [--quiet]\n"
+            "orderbook_replay FILE.csv --to-binary out.flow\n"
+            "FILE is a CSV (kind,side,price,qty,id) or a binary flow file written by --to-binary.\n";
+}
+
+bool parseArgs(int argc, char** argv, Options& opt) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--quiet") {
+            opt.progress = false;
+            continue;
+        }
+        if (arg.rfind("--", 0) != 0 && arg != "-") {
+            if (!opt.input.empty()) return false;
+            opt.input = arg;
+            continue;
+        }
+        if (arg == "-h" || arg == "--help" || i + 1 >= argc) return false;
+        string val = argv[++i];
+        if (arg == "--trades") {
+            opt.tradesPath = val;
+        } else if (arg == "--to-binary") {
+            opt.binaryOut = val;
+        } else if (arg == "--depth") {
+            opt.depth = std::stoull(val);
+        } else if (arg == "--tick") {
+            opt.tickSize = std::stod(val);
+        } else if (arg == "--reserve") {
+            opt.reserve = std::stoull(val);
+        } else {
+            return false;
+        }
+    }
+    return !opt.input.empty();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parseArgs(argc, argv, opt)) {
+        usage();
+        return 2;
+    }
+    try {
+        return opt.binaryOut.empty() ? replay(opt) : convert(opt);
+    } catch (const std::exception& e) {
+        std::cerr << "orderbook_replay: " << e.what() << '\n';
+        return 1;
+    }
+}
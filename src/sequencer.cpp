@@ -0,0 +1,369 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "metrics.h"
+#include "sequencer.h"
+
+thread_local std::size_t ioThread = 0;
+
+Sequencer::Sequencer(const BookConfig& bookConfig, std::size_t shards, std::size_t producers, int firstCpu)
+    : bookConfig_(bookConfig), firstCpu_(firstCpu) {
+    for (std::size_t s = 0; s < std::max<std::size_t>(shards, 1); ++s) {
+        auto shard = std::make_unique<Shard>();
+        shard->index = s;
+        for (std::size_t p = 0; p < producers; ++p) {
+            shard->rings.push_back(std::make_unique<SpscRing<EngineCommand, ringCapacity>>());
+        }
+        shards_.push_back(std::move(shard));
+    }
+}
+
+Sequencer::~Sequencer() { stop(); }
+
+void Sequencer::apply(const EngineCommand& cmd) {
+    execute(*shards_[shardOf(cmd.symbol)], cmd);
+}
+
+bool Sequencer::restoreBook(const Symbol& symbol, const char* data, std::size_t size) {
+    Shard& shard = *shards_[shardOf(symbol)];
+    std::unique_lock lock(shard.booksMutex);
+    auto [it, created] = shard.books.try_emplace(symbol, bookConfig_);
+    orderbook& book = it->second.book;
+    std::size_t orders = book.orderCount();
+    std::size_t levels = book.levelCount();
+    std::size_t stops = book.stopCount();
+    bool ok = book.restore(data, size);
+    it->second.version.store(book.version(), std::memory_order_release);
+    if (metrics_) {
+        metrics::adjust(metrics::Books, created ? 1 : 0);
+        metrics::adjust(metrics::RestingOrders, static_cast<std::int64_t>(book.orderCount()) - static_cast<std::int64_t>(orders));
+        metrics::adjust(metrics::PriceLevels, static_cast<std::int64_t>(book.levelCount()) - static_cast<std::int64_t>(levels));
+        metrics::adjust(metrics::PendingStops, static_cast<std::int64_t>(book.stopCount()) - static_cast<std::int64_t>(stops));
+    }
+    return ok;
+}
+
+void Sequencer::forEachBook(const std::function<void(const Symbol&, const orderbook&)>& fn) const {
+    for (const auto& shard : shards_) {
+        for (const auto& [symbol, book] : shard->books) fn(symbol, book.book);
+    }
+}
+
+// Change capture (and with it candles) starts here, not during replay: the journal has no
+// timestamps, so replayed trades would all land in the bar of the moment the server started.
+void Sequencer::start() {
+    if (running_.exchange(true)) return;
+    for (std::size_t i = 0; i < shards_.size(); ++i) {
+        Shard& shard = *shards_[i];
+        for (auto& [symbol, book] : shard.books) book.book.captureChanges(true);
+        shard.thread = std::thread([this, &shard] { loop(shard); });
+#ifdef __linux__
+        if (firstCpu_ >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(firstCpu_ + static_cast<int>(i), &set);
+            pthread_setaffinity_np(shard.thread.native_handle(), sizeof(set), &set);
+        }
+#endif
+    }
+}
+
+void Sequencer::stop() {
+    if (!running_.exchange(false)) return;
+    for (auto& shard : shards_) {
+        if (shard->thread.joinable()) shard->thread.join();
+    }
+}
+
+void Sequencer::submit(std::size_t producer, const EngineCommand& cmd) {
+    auto& ring = *shards_[shardOf(cmd.symbol)]->rings[producer];
+    EngineCommand stamped = cmd;
+    stamped.queuedAt = metrics::now();
+    while (!ring.tryPush(stamped)) std::this_thread::yield(); // backpressure: the shard is behind
+}
+
+std::uint64_t Sequencer::processed() const {
+    std::uint64_t total = 0;
+    for (const auto& shard : shards_) total += shard->processed.load(std::memory_order_relaxed);
+    return total;
+}
+
+std::uint64_t Sequencer::bookVersion(const Symbol& symbol) const {
+    const Shard& shard = *shards_[shardOf(symbol)];
+    std::shared_lock lock(shard.booksMutex);
+    auto it = shard.books.find(symbol);
+    return it == shard.books.end() ? 0 : it->second.version.load(std::memory_order_acquire);
+}
+
+// Round-robin over the rings so one busy I/O thread can't starve the others. When every
+// ring is empty, spin for a while, then yield, then nap briefly so an idle server doesn't
+// burn a whole core.
+void Sequencer::loop(Shard& shard) {
+    unsigned idle = 0;
+    while (running_.load(std::memory_order_relaxed)) {
+        std::size_t done = 0;
+        for (auto& ring : shard.rings) {
+            done += ring->consume(batchSize, [this, &shard](const EngineCommand& cmd) { execute(shard, cmd); });
+        }
+        if (done) {
+            shard.processed.fetch_add(done, std::memory_order_relaxed);
+            for (auto* entry : shard.dirty) publish(*entry);
+            shard.dirty.clear();
+            idle = 0;
+        } else if (++idle < 4096) {
+            // spin
+        } else if (idle < 8192) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+}
+
+namespace {
+
+// A stop's price rides in the journal record's id field.
+OrderId priceBits(double price) {
+    OrderId bits;
+    std::memcpy(&bits, &price, sizeof(bits));
+    return bits;
+}
+
+double bitsPrice(OrderId bits) {
+    double price;
+    std::memcpy(&price, &bits, sizeof(price));
+    return price;
+}
+
+void countCommand(const EngineCommand& cmd, const EngineReply& reply) {
+    static constexpr metrics::Counter counters[] = {metrics::LimitOrders, metrics::MarketOrders, metrics::Cancels, metrics::Modifies,
+                                                    metrics::BookReads,   metrics::Stimmies,     metrics::Clears,  metrics::Batches,
+                                                    metrics::Stops,       metrics::CandleReads};
+    static constexpr metrics::Counter byType[] = {metrics::LimitOrders, metrics::MarketOrders, metrics::Stops, metrics::Stops};
+    metrics::count(counters[static_cast<std::size_t>(cmd.kind)]);
+    auto fills = [](const ExecutionResults& exec) {
+        if (exec.trades + exec.stopTrades) {
+            metrics::count(metrics::Fills, static_cast<std::uint64_t>(exec.trades + exec.stopTrades));
+            metrics::count(metrics::FilledQty, static_cast<std::uint64_t>(exec.filled + exec.stopFilled));
+        }
+        if (exec.triggered) metrics::count(metrics::StopsTriggered, static_cast<std::uint64_t>(exec.triggered));
+        if (exec.rejected) metrics::count(metrics::Rejected);
+    };
+    if (cmd.kind == EngineCommand::Kind::Batch) {
+        for (std::size_t i = 0; i < reply.results.size(); ++i) {
+            metrics::count(byType[static_cast<std::size_t>(cmd.client->orders[i].type)]);
+            fills(reply.results[i]);
+        }
+        return;
+    }
+    bool trades = cmd.kind == EngineCommand::Kind::Limit || cmd.kind == EngineCommand::Kind::Market ||
+                  (cmd.kind == EngineCommand::Kind::Modify && reply.found);
+    if (trades) fills(reply.exec);
+}
+
+} // namespace
+
+void Sequencer::execute(Shard& shard, const EngineCommand& cmd) {
+    static thread_local std::mt19937 rng(std::random_device{}());
+    static thread_local EngineReply scratch; // reply sink for fire-and-forget commands
+    EngineReply& reply = cmd.client ? cmd.client->reply : scratch;
+    reply.found = true;
+
+    // Orders and stimmy create the book on first use; everything else only looks it up.
+    BookMap::value_type* entry = nullptr;
+    bool live = running_.load(std::memory_order_relaxed); // false while apply() replays
+    bool creates = cmd.kind == EngineCommand::Kind::Limit || cmd.kind == EngineCommand::Kind::Market ||
+                   cmd.kind == EngineCommand::Kind::Stimmy || cmd.kind == EngineCommand::Kind::Batch ||
+                   cmd.kind == EngineCommand::Kind::Stop;
+    auto it = shard.books.find(cmd.symbol);
+    if (it != shard.books.end()) {
+        entry = &*it;
+    } else if (creates) {
+        std::unique_lock lock(shard.booksMutex); // only this thread writes the map, so finds above need no lock
+        entry = &*shard.books.try_emplace(cmd.symbol, bookConfig_).first;
+        if (live) entry->second.book.captureChanges(true);
+        if (metrics_) metrics::adjust(metrics::Books, 1);
+    }
+    orderbook* book = entry ? &entry->second.book : nullptr;
+    std::size_t ordersBefore = book ? book->orderCount() : 0;
+    std::size_t stopsBefore = book ? book->stopCount() : 0;
+    std::size_t levelsBefore = book ? book->levelCount() : 0;
+    std::size_t growthsBefore = book ? book->heapGrowths() : 0;
+
+    // With metrics on, the TSC reads double as the latency_ns clock.
+    std::uint64_t startTicks = metrics::now();
+    std::chrono::steady_clock::time_point start;
+    if constexpr (!metrics::enabled) start = std::chrono::steady_clock::now();
+
+    switch (cmd.kind) {
+        case EngineCommand::Kind::Limit:
+            reply.exec = book->addLimitOrder(cmd.price, cmd.qty, cmd.side);
+            break;
+        case EngineCommand::Kind::Market:
+            reply.exec = book->addMarketOrder(cmd.qty, cmd.side);
+            break;
+        case EngineCommand::Kind::Stop:
+            reply.exec = cmd.hasPrice ? book->addStopLimitOrder(cmd.stopPrice, cmd.price, cmd.qty, cmd.side)
+                                      : book->addStopOrder(cmd.stopPrice, cmd.qty, cmd.side);
+            break;
+        case EngineCommand::Kind::Cancel:
+            reply.found = book && book->cancel(cmd.id);
+            break;
+        case EngineCommand::Kind::Modify: {
+            std::optional<ExecutionResults> exec;
+            if (book) exec = cmd.hasPrice ? book->modify(cmd.id, cmd.qty, cmd.price) : book->modify(cmd.id, cmd.qty);
+            reply.found = exec.has_value();
+            if (exec) reply.exec = *exec;
+            break;
+        }
+        case EngineCommand::Kind::Book:
+            if (book) {
+                // Flush pending changes first so the snapshot lines up exactly with bookSeq.
+                if (entry->second.dirty) publish(*entry);
+                book->snapshot(cmd.depth, reply.book);
+                reply.spread = book->spread();
+                reply.bookSeq = entry->second.seq;
+                reply.bookVersion = book->version();
+            } else {
+                reply.book.bids.clear();
+                reply.book.asks.clear();
+                reply.spread.reset();
+                reply.bookSeq = 0;
+                reply.bookVersion = 0;
+            }
+            break;
+        case EngineCommand::Kind::Stimmy: {
+            static thread_local std::vector<OrderCommand> orders;
+            std::uniform_real_distribution<double> priceDist(95.0, 125.0);
+            std::uniform_int_distribution<int> qtyDist(1, 25);
+            orders.clear();
+            for (int i = 0; i < 20; ++i) {
+                for (Side side : {Side::Buy, Side::Sell}) orders.push_back({side, OrderType::Limit, priceDist(rng), qtyDist(rng), 0.0});
+            }
+            reply.results.resize(orders.size());
+            book->submitBatch(orders.data(), orders.size(), reply.results.data());
+            // Random, so journal what it actually placed.
+            if (journal_) recordOrders(shard, orders, cmd.symbol);
+            break;
+        }
+        case EngineCommand::Kind::Batch: {
+            const auto& orders = cmd.client->orders;
+            reply.results.resize(orders.size());
+            book->submitBatch(orders.data(), orders.size(), reply.results.data());
+            if (journal_) recordOrders(shard, orders, cmd.symbol);
+            break;
+        }
+        case EngineCommand::Kind::Clear:
+            if (book) book->clear();
+            break;
+        case EngineCommand::Kind::Candles: {
+            const CandleSeries* series = nullptr;
+            if (book) {
+                if (entry->second.dirty) publish(*entry); // so the bars include this pass's trades
+                series = entry->second.candles.find(static_cast<std::int64_t>(cmd.id));
+            }
+            if (series) series->latest(cmd.depth, reply.candles);
+            else reply.candles.clear();
+            break;
+        }
+    }
+    if constexpr (metrics::enabled) {
+        std::uint64_t matchTicks = metrics::now() - startTicks;
+        reply.matchNs = static_cast<long long>(metrics::toNs(matchTicks));
+        // Replay counts towards the gauges, which describe the books, but not the counters and
+        // latencies, which describe the traffic since start().
+        if (metrics_ && live) {
+            metrics::record(metrics::Match, matchTicks);
+            if (cmd.queuedAt) metrics::record(metrics::Queue, startTicks - cmd.queuedAt);
+            countCommand(cmd, reply);
+            if (book) metrics::count(metrics::HeapGrowths, book->heapGrowths() - growthsBefore);
+        }
+        if (metrics_ && book) {
+            metrics::adjust(metrics::RestingOrders, static_cast<std::int64_t>(book->orderCount()) - static_cast<std::int64_t>(ordersBefore));
+            metrics::adjust(metrics::PendingStops, static_cast<std::int64_t>(book->stopCount()) - static_cast<std::int64_t>(stopsBefore));
+            metrics::adjust(metrics::PriceLevels, static_cast<std::int64_t>(book->levelCount()) - static_cast<std::int64_t>(levelsBefore));
+        }
+    } else {
+        reply.matchNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+    // Rejected limits are journalled too: they still used up an id.
+    if (journal_) {
+        bool changed = cmd.kind == EngineCommand::Kind::Limit || cmd.kind == EngineCommand::Kind::Market ||
+                       cmd.kind == EngineCommand::Kind::Stop ||
+                       ((cmd.kind == EngineCommand::Kind::Cancel || cmd.kind == EngineCommand::Kind::Modify) && reply.found) ||
+                       (cmd.kind == EngineCommand::Kind::Clear && book);
+        OrderId id = cmd.kind == EngineCommand::Kind::Stop ? priceBits(cmd.stopPrice) : cmd.id;
+        if (changed) record(shard, cmd.kind, cmd.side, cmd.hasPrice, cmd.qty, cmd.price, id, cmd.symbol);
+    }
+    bool read = cmd.kind == EngineCommand::Kind::Book || cmd.kind == EngineCommand::Kind::Candles;
+    if (book && !read) entry->second.version.store(book->version(), std::memory_order_release);
+    if (live && entry && !read && !entry->second.dirty) {
+        entry->second.dirty = true;
+        shard.dirty.push_back(entry);
+    }
+    if (cmd.client) cmd.client->engineDone();
+}
+
+// Candles are fed here whether or not there's a feed to publish to.
+void Sequencer::publish(BookMap::value_type& entry) {
+    static thread_local std::vector<LevelUpdate> levels;
+    static thread_local std::vector<TradePrint> trades;
+    Book& book = entry.second;
+    book.dirty = false;
+    levels.clear();
+    trades.clear();
+    if (!book.book.takeChanges(levels, trades)) return;
+    if (!trades.empty()) {
+        // One clock read per pass, so a bar's trades are timed to within a batch of commands.
+        book.candles.add(trades.data(), trades.size(), candleClock());
+    }
+    if (!feed_ || !feed_->wants(entry.first)) return;
+    auto update = std::make_shared<BookUpdate>();
+    update->levels.swap(levels); // the update keeps the buffers; the next pass grows fresh ones, as before
+    update->trades.swap(trades);
+    update->symbol = entry.first;
+    update->seq = ++book.seq;
+    feed_->publish(std::move(update));
+}
+
+// A batch goes in the journal as the plain limits, markets and stops it ran, so replay needs
+// no batch support (and the per-order ids come out the same).
+void Sequencer::recordOrders(Shard& shard, const std::vector<OrderCommand>& orders, const Symbol& symbol) {
+    for (const OrderCommand& o : orders) {
+        switch (o.type) {
+            case OrderType::Limit: record(shard, EngineCommand::Kind::Limit, o.side, true, o.quantity, o.price, 0, symbol); break;
+            case OrderType::Market: record(shard, EngineCommand::Kind::Market, o.side, false, o.quantity, 0.0, 0, symbol); break;
+            case OrderType::Stop:
+            case OrderType::StopLimit:
+                record(shard, EngineCommand::Kind::Stop, o.side, o.type == OrderType::StopLimit, o.quantity,
+                       o.type == OrderType::StopLimit ? o.price : 0.0, priceBits(o.stopPrice), symbol);
+                break;
+        }
+    }
+}
+
+void Sequencer::record(Shard& shard, EngineCommand::Kind kind, Side side, bool hasPrice, int qty, double price, OrderId id,
+                       const Symbol& symbol) {
+    JournalRecord rec{static_cast<std::uint8_t>(kind), static_cast<std::uint8_t>(side), hasPrice, 0, qty, price, id, symbol, 0};
+    rec.seal();
+    journal_->append(shard.index, rec);
+}
+
+EngineCommand replayCommand(const JournalRecord& record) {
+    EngineCommand cmd{static_cast<EngineCommand::Kind>(record.kind), static_cast<Side>(record.side), record.hasPrice != 0,
+                      record.qty, record.price, record.id, 0, record.symbol, nullptr};
+    if (cmd.kind == EngineCommand::Kind::Stop) {
+        cmd.stopPrice = bitsPrice(record.id);
+        cmd.id = 0;
+    }
+    return cmd;
+}
@@ -0,0 +1,454 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "orderbook.h"
+
+using std::cout;
+using std::string;
+using std::vector;
+
+// Many independent seeded simulations, each the CLI stimmy's idea (random limit and market
+// orders into one book) with its own order-flow parameters, spread over every core. Run i
+// only depends on --seed and i, so the per-run CSV and the aggregate come out the same
+// whatever the thread count or whichever thread ran it.
+//
+// Scheduling is work stealing over run indices: each worker starts with an even slice of
+// the runs and takes them from the front; one that runs dry steals the back half of another
+// worker's slice. A slice is [begin, end) packed into one 64-bit atomic, so taking and
+// stealing are both a single CAS. Each worker owns its book (cleared between runs) and its
+// counters, on their own cache lines. Runs write their result into their own slot, and the
+// main thread streams finished results out in run order as they come in.
+
+namespace {
+
+// splitmix64 so a seed gives the same stream on every compiler/standard library.
+class Rng {
+public:
+    explicit Rng(std::uint64_t seed) : state_(seed) {}
+    std::uint64_t next() {
+        std::uint64_t z = (state_ += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    int uniform(int lo, int hi) { return lo + static_cast<int>(next() % static_cast<std::uint64_t>(hi - lo + 1)); }
+    double unit() { return static_cast<double>(next() >> 11) * 0x1.0p-53; }
+    double between(double lo, double hi) { return lo + unit() * (hi - lo); }
+    bool chance(double percent) { return unit() * 100.0 < percent; }
+private:
+    std::uint64_t state_;
+};
+
+struct Range {
+    double lo;
+    double hi;
+};
+
+struct Options {
+    std::size_t runs{1000};
+    Range orders{500, 5000};          // orders per run
+    Range market{5, 30};              // % market orders
+    Range cancel{0, 20};              // % cancels of a recent resting order
+    Range spread{1.0, 15.0};          // limits land within this far of the fair price
+    Range vol{0.0, 0.05};             // fair price step per order
+    std::size_t threads{std::max(1u, std::thread::hardware_concurrency())};
+    vector<std::size_t> scaling;      // non-empty: run the whole set once per thread count
+    std::uint64_t seed{42};
+    string csvPath;
+    bool progress{true};
+};
+
+// Everything a run reports; filled in by the worker that ran it.
+struct RunResult {
+    std::uint64_t seed;
+    int orders;
+    double marketPct;
+    double cancelPct;
+    double spread;
+    double vol;
+    std::int64_t trades;
+    std::int64_t filled;              // qty
+    double notional;
+    double lastPrice;                 // average price of the last order that traded; 0 if none did
+    std::int64_t cancels;             // cancels that found their order
+    std::int64_t rejected;
+    std::size_t resting;
+};
+
+// Run i's parameters and flow come from this alone.
+std::uint64_t runSeed(std::uint64_t seed, std::size_t run) {
+    Rng rng(seed ^ (0xA0761D6478BD642Full * (run + 1)));
+    return rng.next();
+}
+
+void simulate(orderbook& book, std::uint64_t seed, const Options& opt, RunResult& out) {
+    Rng rng(seed);
+    out = RunResult{};
+    out.seed = seed;
+    out.orders = static_cast<int>(std::lround(rng.between(opt.orders.lo, opt.orders.hi)));
+    out.marketPct = rng.between(opt.market.lo, opt.market.hi);
+    out.cancelPct = rng.between(opt.cancel.lo, opt.cancel.hi);
+    out.spread = rng.between(opt.spread.lo, opt.spread.hi);
+    out.vol = rng.between(opt.vol.lo, opt.vol.hi);
+
+    book.clear();
+    double fair = 100.0;
+    OrderId recent[256] = {};
+    std::size_t limits = 0;
+    for (int i = 0; i < out.orders; ++i) {
+        fair = std::max(1.0, fair + out.vol * (rng.unit() * 2.0 - 1.0));
+        Side side = rng.chance(50) ? Side::Buy : Side::Sell;
+        int qty = rng.uniform(1, 25);
+        ExecutionResults exec{};
+        if (limits && rng.chance(out.cancelPct)) {
+            OrderId& id = recent[rng.next() % std::min<std::size_t>(limits, 256)];
+            if (id && book.cancel(id)) ++out.cancels;
+            id = 0;
+            continue;
+        }
+        if (rng.chance(out.marketPct)) {
+            exec = book.addMarketOrder(qty, side);
+        } else {
+            // Mostly passive: a quarter of the range crosses the fair price.
+            double offset = out.spread * (rng.unit() - 0.25);
+            double price = std::max(0.01, side == Side::Buy ? fair - offset : fair + offset);
+            exec = book.addLimitOrder(price, qty, side);
+            if (exec.rejected) ++out.rejected;
+            else if (exec.filled < exec.requested) recent[limits++ % 256] = exec.id;
+        }
+        if (exec.filled > 0) {
+            out.trades += exec.trades;
+            out.filled += exec.filled;
+            out.notional += exec.notional;
+            out.lastPrice = exec.notional / exec.filled;
+        }
+    }
+    out.resting = book.orderCount();
+}
+
+// A worker's slice of run indices: begin in the low half, end in the high half.
+constexpr std::uint64_t pack(std::uint32_t begin, std::uint32_t end) { return std::uint64_t{end} << 32 | begin; }
+constexpr std::uint32_t beginOf(std::uint64_t r) { return static_cast<std::uint32_t>(r); }
+constexpr std::uint32_t endOf(std::uint64_t r) { return static_cast<std::uint32_t>(r >> 32); }
+
+struct alignas(64) Worker {
+    std::atomic<std::uint64_t> range{0};
+    std::uint64_t runs{0};
+    std::uint64_t steals{0};
+    std::unique_ptr<orderbook> book;
+
+    // The owner's end: the next run from the front, or false when the slice is empty.
+    bool take(std::uint32_t& run) {
+        std::uint64_t r = range.load(std::memory_order_relaxed);
+        while (beginOf(r) < endOf(r)) {
+            if (range.compare_exchange_weak(r, pack(beginOf(r) + 1, endOf(r)), std::memory_order_acq_rel)) {
+                run = beginOf(r);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // A thief's end: the back half (at least one run) of victim's slice becomes ours.
+    bool stealFrom(Worker& victim) {
+        std::uint64_t r = victim.range.load(std::memory_order_relaxed);
+        while (beginOf(r) < endOf(r)) {
+            std::uint32_t mid = beginOf(r) + (endOf(r) - beginOf(r)) / 2;
+            if (victim.range.compare_exchange_weak(r, pack(beginOf(r), mid), std::memory_order_acq_rel)) {
+                // Our slice is empty, so nobody else will CAS it successfully until this lands.
+                range.store(pack(mid, endOf(r)), std::memory_order_release);
+                ++steals;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+struct Batch {
+    double seconds{0.0};
+    std::uint64_t steals{0};
+    vector<std::uint64_t> perWorker;
+};
+
+// Runs every simulation on `threads` workers. `onProgress` is called on this thread with the
+// number of leading runs that have finished, as more of them do.
+template <typename OnProgress>
+Batch runAll(const Options& opt, std::size_t threads, vector<RunResult>& results, OnProgress onProgress) {
+    std::size_t runs = results.size();
+    vector<Worker> workers(threads);
+    for (std::size_t w = 0; w < threads; ++w) {
+        BookConfig config;
+        config.ladderTicks = 8192;
+        config.reserveOrders = static_cast<std::size_t>(opt.orders.hi) + 1;
+        workers[w].book = std::make_unique<orderbook>(config);
+        workers[w].range.store(pack(static_cast<std::uint32_t>(runs * w / threads), static_cast<std::uint32_t>(runs * (w + 1) / threads)));
+    }
+    std::unique_ptr<std::atomic<bool>[]> done(new std::atomic<bool>[runs]);
+    for (std::size_t i = 0; i < runs; ++i) done[i].store(false, std::memory_order_relaxed);
+    std::atomic<std::size_t> finished{0};
+
+    auto work = [&](std::size_t self) {
+        Worker& me = workers[self];
+        Rng victims(opt.seed + self);
+        for (;;) {
+            std::uint32_t run;
+            while (me.take(run)) {
+                simulate(*me.book, runSeed(opt.seed, run), opt, results[run]);
+                done[run].store(true, std::memory_order_release);
+                ++me.runs;
+            }
+            // Try everyone once, starting somewhere random; all empty means we're done
+            // (work only ever moves between slices, it's never added).
+            bool stole = false;
+            std::size_t start = static_cast<std::size_t>(victims.next() % threads);
+            for (std::size_t k = 0; k < threads && !stole; ++k) {
+                std::size_t v = (start + k) % threads;
+                if (v != self) stole = me.stealFrom(workers[v]);
+            }
+            if (!stole) break;
+        }
+        finished.fetch_add(1, std::memory_order_release);
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    vector<std::thread> pool;
+    for (std::size_t w = 1; w < threads; ++w) pool.emplace_back(work, w);
+    std::size_t prefix = 0;
+    if (threads == 1) {
+        work(0);
+    } else {
+        // This thread only polls for finished runs to stream out; worker 0 gets a thread too.
+        pool.emplace_back(work, 0);
+        while (finished.load(std::memory_order_acquire) < threads) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            std::size_t before = prefix;
+            while (prefix < runs && done[prefix].load(std::memory_order_acquire)) ++prefix;
+            if (prefix != before) onProgress(prefix);
+        }
+    }
+    for (auto& t : pool) t.join();
+    Batch batch;
+    batch.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (prefix < runs) onProgress(runs);
+    for (const Worker& w : workers) {
+        batch.steals += w.steals;
+        batch.perWorker.push_back(w.runs);
+    }
+    return batch;
+}
+
+// Folds results in run order, so floating-point sums come out identical every time.
+struct Aggregate {
+    std::size_t runs{0};
+    std::int64_t orders{0};
+    std::int64_t trades{0};
+    std::int64_t filled{0};
+    double notional{0.0};
+    std::int64_t cancels{0};
+    std::int64_t rejected{0};
+    std::uint64_t resting{0};
+    double moveMean{0.0};             // last trade vs the 100 start, runs that traded
+    double moveM2{0.0};
+    std::size_t traded{0};
+    std::uint64_t digest{1469598103934665603ull};
+    vector<std::int64_t> tradesPerRun;
+
+    void add(const RunResult& r) {
+        ++runs;
+        orders += r.orders;
+        trades += r.trades;
+        filled += r.filled;
+        notional += r.notional;
+        cancels += r.cancels;
+        rejected += r.rejected;
+        resting += r.resting;
+        tradesPerRun.push_back(r.trades);
+        if (r.filled > 0) {
+            double move = r.lastPrice - 100.0;
+            ++traded;
+            double delta = move - moveMean;
+            moveMean += delta / static_cast<double>(traded);
+            moveM2 += delta * (move - moveMean);
+        }
+        std::uint64_t bits;
+        std::memcpy(&bits, &r.notional, sizeof(bits));
+        for (std::uint64_t v : {static_cast<std::uint64_t>(r.trades), static_cast<std::uint64_t>(r.filled), std::uint64_t{r.resting}, bits}) {
+            digest = (digest ^ v) * 1099511628211ull;
+        }
+    }
+
+    std::int64_t tradesQuantile(double q) const {
+        if (tradesPerRun.empty()) return 0;
+        vector<std::int64_t> sorted = tradesPerRun;
+        std::size_t at = std::min(sorted.size() - 1, static_cast<std::size_t>(q * static_cast<double>(sorted.size())));
+        std::nth_element(sorted.begin(), sorted.begin() + static_cast<std::ptrdiff_t>(at), sorted.end());
+        return sorted[at];
+    }
+};
+
+void writeCsvHeader(std::ostream& os) {
+    os << "run,seed,orders,market_pct,cancel_pct,spread,vol,trades,filled,vwap,last_price,cancels,rejected,resting\n";
+}
+
+void writeCsvRow(std::ostream& os, std::size_t run, const RunResult& r) {
+    os << run << ',' << r.seed << ',' << r.orders << ',' << std::setprecision(2) << r.marketPct << ',' << r.cancelPct << ',' << r.spread
+       << ',' << std::setprecision(4) << r.vol << ',' << r.trades << ',' << r.filled << ',' << (r.filled ? r.notional / r.filled : 0.0)
+       << ',' << r.lastPrice << ',' << r.cancels << ',' << r.rejected << ',' << r.resting << '\n';
+}
+
+void printAggregate(const Aggregate& a) {
+    cout << std::fixed << std::setprecision(2);
+    cout << a.runs << " runs, " << a.orders << " orders, " << a.trades << " trades, " << a.filled << " filled";
+    if (a.filled) cout << " at vwap " << std::setprecision(4) << a.notional / static_cast<double>(a.filled);
+    cout << '\n' << a.cancels << " cancels, " << a.rejected << " rejected, " << a.resting << " left resting\n";
+    cout << "trades per run p10/p50/p90/max: " << a.tradesQuantile(0.1) << " / " << a.tradesQuantile(0.5) << " / " << a.tradesQuantile(0.9) << " / "
+         << a.tradesQuantile(1.0) << '\n';
+    if (a.traded) {
+        cout << "last trade vs 100: mean " << std::showpos << std::setprecision(3) << a.moveMean << std::noshowpos << ", sd "
+             << std::sqrt(a.traded > 1 ? a.moveM2 / static_cast<double>(a.traded - 1) : 0.0) << " (" << a.traded << " runs traded)\n";
+    }
+    cout << "digest " << std::hex << a.digest << std::dec << '\n';
+}
+
+void usage() {
+    cout << "orderbook_sim [--runs 1000] [--threads N] [--seed 42] [--csv runs.csv] [--quiet]\n"
+            "              [--orders 500:5000] [--market 5:30] [--cancel 0:20] [--spread 1:15] [--vol 0:0.05]\n"
+            "orderbook_sim --scaling 1,2,4,8 [same options]\n"
+            "Each run draws its order count and flow parameters uniformly from the lo:hi ranges.\n";
+}
+
+vector<string> split(const string& s, char sep) {
+    vector<string> out;
+    std::stringstream ss(s);
+    string item;
+    while (std::getline(ss, item, sep)) out.push_back(item);
+    return out;
+}
+
+Range parseRange(const string& s) {
+    auto parts = split(s, ':');
+    if (parts.size() == 1) return Range{std::stod(parts[0]), std::stod(parts[0])};
+    if (parts.size() != 2) throw std::invalid_argument("range");
+    return Range{std::stod(parts[0]), std::stod(parts[1])};
+}
+
+bool parseArgs(int argc, char** argv, Options& opt) {
+    try {
+        for (int i = 1; i < argc; ++i) {
+            string arg = argv[i];
+            if (arg == "--quiet") {
+                opt.progress = false;
+                continue;
+            }
+            if (arg == "-h" || arg == "--help" || i + 1 >= argc) return false;
+            string val = argv[++i];
+            if (arg == "--runs") opt.runs = std::stoull(val);
+            else if (arg == "--threads") opt.threads = std::max<std::size_t>(1, std::stoull(val));
+            else if (arg == "--seed") opt.seed = std::stoull(val);
+            else if (arg == "--csv") opt.csvPath = val;
+            else if (arg == "--orders") opt.orders = parseRange(val);
+            else if (arg == "--market") opt.market = parseRange(val);
+            else if (arg == "--cancel") opt.cancel = parseRange(val);
+            else if (arg == "--spread") opt.spread = parseRange(val);
+            else if (arg == "--vol") opt.vol = parseRange(val);
+            else if (arg == "--scaling") {
+                for (const auto& s : split(val, ',')) opt.scaling.push_back(std::max<std::size_t>(1, std::stoull(s)));
+            } else {
+                return false;
+            }
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    return opt.runs > 0 && opt.runs < (1ull << 32) && opt.orders.lo >= 0 && opt.orders.hi >= opt.orders.lo;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parseArgs(argc, argv, opt)) {
+        usage();
+        return 2;
+    }
+    vector<RunResult> results(opt.runs);
+
+    if (!opt.scaling.empty()) {
+        cout << opt.runs << " runs of " << opt.orders.lo << "-" << opt.orders.hi << " orders, seed " << opt.seed << '\n';
+        cout << std::setw(8) << "threads" << std::setw(10) << "wall ms" << std::setw(10) << "runs/s" << std::setw(13) << "orders/s"
+             << std::setw(9) << "speedup" << std::setw(8) << "steals" << "  digest\n";
+        double base = 0.0;
+        std::uint64_t firstDigest = 0;
+        bool same = true;
+        for (std::size_t threads : opt.scaling) {
+            Batch batch = runAll(opt, threads, results, [](std::size_t) {});
+            Aggregate agg;
+            for (const RunResult& r : results) agg.add(r);
+            if (base == 0.0) {
+                base = batch.seconds;
+                firstDigest = agg.digest;
+            }
+            same = same && agg.digest == firstDigest;
+            cout << std::fixed << std::setw(8) << threads << std::setw(10) << std::setprecision(1) << batch.seconds * 1e3 << std::setw(10)
+                 << std::setprecision(0) << static_cast<double>(opt.runs) / batch.seconds << std::setw(13)
+                 << static_cast<double>(agg.orders) / batch.seconds << std::setw(9) << std::setprecision(2) << base / batch.seconds
+                 << std::setw(8) << batch.steals << "  " << std::hex << agg.digest << std::dec << '\n';
+        }
+        if (!same) {
+            cout << "results differ between thread counts\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    std::ofstream csv;
+    if (!opt.csvPath.empty()) {
+        csv.open(opt.csvPath);
+        if (!csv) {
+            std::cerr << "cannot write " << opt.csvPath << '\n';
+            return 1;
+        }
+        writeCsvHeader(csv);
+    }
+
+    // Stream finished runs out in order: into the CSV and the aggregate, with a progress
+    // line on stderr about once a second.
+    Aggregate agg;
+    std::size_t streamed = 0;
+    auto started = std::chrono::steady_clock::now();
+    auto lastLine = started;
+    Batch batch = runAll(opt, opt.threads, results, [&](std::size_t prefix) {
+        for (; streamed < prefix; ++streamed) {
+            if (csv.is_open()) writeCsvRow(csv, streamed, results[streamed]);
+            agg.add(results[streamed]);
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (opt.progress && now - lastLine >= std::chrono::seconds(1)) {
+            lastLine = now;
+            std::cerr << std::fixed << std::setprecision(0) << streamed << "/" << opt.runs << " runs, " << agg.trades << " trades, "
+                      << static_cast<double>(streamed) / std::chrono::duration<double>(now - started).count() << " runs/s\n";
+        }
+    });
+
+    printAggregate(agg);
+    cout << std::fixed << std::setprecision(1) << opt.threads << " threads, " << batch.seconds * 1e3 << " ms, " << std::setprecision(0)
+         << static_cast<double>(opt.runs) / batch.seconds << " runs/s, " << static_cast<double>(agg.orders) / batch.seconds << " orders/s, "
+         << batch.steals << " steals, runs per thread";
+    for (std::uint64_t n : batch.perWorker) cout << ' ' << n;
+    cout << '\n';
+    return 0;
+}
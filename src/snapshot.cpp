@@ -0,0 +1,208 @@
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+
+namespace {
+
+constexpr char magic[8] = {'O', 'B', 'S', 'N', 'A', 'P', '\0', '\0'};
+constexpr std::uint32_t version = 1;
+
+struct FileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t books;
+    std::uint64_t journalOffset;
+};
+
+// Followed by `size` bytes of image, padded to a multiple of 8.
+struct BookHeader {
+    Symbol symbol;
+    std::uint64_t size;
+};
+
+static_assert(sizeof(FileHeader) == 24 && sizeof(BookHeader) == 24);
+
+std::size_t padded(std::size_t n) { return (n + 7) & ~std::size_t{7}; }
+
+} // namespace
+
+SnapshotFile::~SnapshotFile() {
+    if (map_) ::munmap(map_, size_);
+}
+
+bool SnapshotFile::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) return false;
+        throw std::runtime_error("can't open snapshot " + path + ": " + std::strerror(errno));
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(FileHeader)) {
+        ::close(fd);
+        throw std::runtime_error(path + " is too short to be a snapshot");
+    }
+    size_ = static_cast<std::size_t>(st.st_size);
+    map_ = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map_ == MAP_FAILED) {
+        map_ = nullptr;
+        throw std::runtime_error("can't map snapshot " + path + ": " + std::strerror(errno));
+    }
+    ::madvise(map_, size_, MADV_SEQUENTIAL);
+
+    const char* base = static_cast<const char*>(map_);
+    FileHeader header;
+    std::memcpy(&header, base, sizeof(header));
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version) {
+        throw std::runtime_error(path + " is not a version " + std::to_string(version) + " snapshot");
+    }
+    journalOffset_ = header.journalOffset;
+    std::size_t at = sizeof(header);
+    for (std::uint32_t i = 0; i < header.books; ++i) {
+        BookHeader book;
+        if (at + sizeof(book) > size_) throw std::runtime_error(path + " is truncated");
+        std::memcpy(&book, base + at, sizeof(book));
+        at += sizeof(book);
+        if (book.size > size_ - at) throw std::runtime_error(path + " is truncated");
+        books_.push_back({book.symbol, base + at, static_cast<std::size_t>(book.size)});
+        at += padded(static_cast<std::size_t>(book.size));
+    }
+    return true;
+}
+
+void writeSnapshot(const std::string& path, std::uint64_t journalOffset, const Sequencer& books) {
+    std::vector<char> out(sizeof(FileHeader));
+    std::uint32_t count = 0;
+    books.forEachBook([&](const Symbol& symbol, const orderbook& book) {
+        std::size_t at = out.size();
+        out.resize(at + sizeof(BookHeader));
+        book.save(out);
+        BookHeader header{symbol, out.size() - at - sizeof(BookHeader)};
+        std::memcpy(out.data() + at, &header, sizeof(header));
+        out.resize(padded(out.size()));
+        ++count;
+    });
+    FileHeader header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.books = count;
+    header.journalOffset = journalOffset;
+    std::memcpy(out.data(), &header, sizeof(header));
+
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw std::runtime_error("can't create " + tmp + ": " + std::strerror(errno));
+    const char* data = out.data();
+    std::size_t left = out.size();
+    while (left) {
+        ssize_t n = ::write(fd, data, left);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            ::close(fd);
+            throw std::runtime_error("can't write " + tmp + ": " + std::strerror(errno));
+        }
+        data += n;
+        left -= static_cast<std::size_t>(n);
+    }
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("can't move snapshot into place at " + path + ": " + std::strerror(errno));
+    }
+}
+
+Snapshotter::Snapshotter(const BookConfig& config, std::string journalPath, std::string snapshotPath,
+                         std::chrono::seconds interval)
+    : replica_(config, 1, 0),
+      journalPath_(std::move(journalPath)),
+      snapshotPath_(std::move(snapshotPath)),
+      interval_(interval),
+      buffer_(1u << 20) {
+    replica_.setMetrics(false); // the live books are already counted
+}
+
+Snapshotter::~Snapshotter() {
+    stop();
+    if (journalFd_ >= 0) ::close(journalFd_);
+}
+
+void Snapshotter::start(bool seed) {
+    thread_ = std::thread([this, seed] { loop(seed); });
+}
+
+void Snapshotter::stop() {
+    if (!thread_.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+}
+
+void Snapshotter::loop(bool seed) {
+    try {
+        if (seed) {
+            SnapshotFile file;
+            if (file.open(snapshotPath_)) {
+                for (const auto& book : file.books()) replica_.restoreBook(book.symbol, book.data, book.size);
+                offset_ = written_ = file.journalOffset();
+            }
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            bool last = wake_.wait_for(lock, interval_, [this] { return stopping_; });
+            lock.unlock();
+            catchUp();
+            if (offset_ != written_) write();
+            if (last) return;
+            lock.lock();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "snapshots stopped: " << e.what() << '\n';
+    }
+}
+
+// Apply whatever whole, intact records the journal writer has put in the file since last
+// time. A record that's still being written fails its checksum and is picked up next round.
+void Snapshotter::catchUp() {
+    if (journalFd_ < 0) {
+        journalFd_ = ::open(journalPath_.c_str(), O_RDONLY);
+        if (journalFd_ < 0) return;
+    }
+    if (offset_ < Journal::headerBytes) offset_ = Journal::headerBytes;
+    for (;;) {
+        ssize_t n = ::pread(journalFd_, buffer_.data(), buffer_.size(), static_cast<off_t>(offset_));
+        if (n <= 0) return;
+        std::size_t whole = static_cast<std::size_t>(n) / sizeof(JournalRecord);
+        for (std::size_t i = 0; i < whole; ++i) {
+            JournalRecord record;
+            std::memcpy(&record, buffer_.data() + i * sizeof(JournalRecord), sizeof(record));
+            if (!record.intact()) return;
+            replica_.apply(replayCommand(record));
+            offset_ += sizeof(JournalRecord);
+        }
+        if (static_cast<std::size_t>(n) < buffer_.size()) return;
+    }
+}
+
+void Snapshotter::write() {
+    auto start = std::chrono::steady_clock::now();
+    try {
+        writeSnapshot(snapshotPath_, offset_, replica_);
+    } catch (const std::exception& e) {
+        std::cerr << "snapshot failed: " << e.what() << '\n'; // try again next interval
+        return;
+    }
+    written_ = offset_;
+    auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Snapshot at journal byte " << offset_ << " written in " << ms << " ms" << std::endl;
+}